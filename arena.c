@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#define DEBUG 0
+
+#if DEBUG
+#define DEBUG_PRINTF(...)  printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINTF(...)
+#endif
+
+#include "arena.h"
+#include <stdlib.h>
+
+/* Arena allocations are aligned for any of these. */
+union alignment {
+  long long l;
+  double d;
+  void *p;
+};
+
+#define ALIGN(size) (((size) + sizeof(union alignment) - 1) & \
+                     ~(sizeof(union alignment) - 1))
+
+/*---------------------------------------------------------------------------*/
+static void *heap_alloc(size_t size, void *context);
+static void heap_free(void *ptr, void *context);
+static void *arena_alloc(size_t size, void *context);
+static void arena_free(void *ptr, void *context);
+/*---------------------------------------------------------------------------*/
+
+const struct ubasic_allocator ubasic_malloc_allocator = {
+  heap_alloc, heap_free, NULL
+};
+
+/*---------------------------------------------------------------------------*/
+static void *
+heap_alloc(size_t size, void *context)
+{
+  return malloc(size);
+}
+/*---------------------------------------------------------------------------*/
+static void
+heap_free(void *ptr, void *context)
+{
+  free(ptr);
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_arena_init(struct ubasic_arena *arena, void *buffer, size_t size)
+{
+  /* The first allocation starts at an aligned address too. */
+  size_t skip = ALIGN((size_t)buffer) - (size_t)buffer;
+
+  if(skip > size) {
+    skip = size;
+  }
+  arena->buffer = (char *)buffer + skip;
+  arena->size = size - skip;
+  arena->used = 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_arena_reset(struct ubasic_arena *arena)
+{
+  arena->used = 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_arena_allocator(struct ubasic_arena *arena,
+                       struct ubasic_allocator *allocator)
+{
+  allocator->alloc = arena_alloc;
+  allocator->free = arena_free;
+  allocator->context = arena;
+}
+/*---------------------------------------------------------------------------*/
+static void *
+arena_alloc(size_t size, void *context)
+{
+  struct ubasic_arena *arena = context;
+  void *ptr;
+
+  size = ALIGN(size);
+  if(size > arena->size - arena->used) {
+    DEBUG_PRINTF("arena_alloc: %lu bytes do not fit\n", (unsigned long)size);
+    return NULL;
+  }
+  ptr = arena->buffer + arena->used;
+  arena->used += size;
+  return ptr;
+}
+/*---------------------------------------------------------------------------*/
+static void
+arena_free(void *ptr, void *context)
+{
+  /* Arena memory is only given back by ubasic_arena_reset(). */
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+/*
+ * Everything the interpreter and the compiler allocate goes through a
+ * ubasic_allocator. Where one is passed in, NULL means
+ * ubasic_malloc_allocator, which uses malloc() and free().
+ */
+
+typedef void *(*ubasic_alloc_func)(size_t, void *);
+typedef void (*ubasic_free_func)(void *, void *);
+
+struct ubasic_allocator {
+  ubasic_alloc_func alloc;
+  ubasic_free_func free;
+  void *context;
+};
+
+/*
+ * An arena hands out memory from a buffer supplied by the caller, one
+ * allocation after the other. Freeing does nothing; instead the whole
+ * arena is emptied at once with ubasic_arena_reset().
+ */
+struct ubasic_arena {
+  char *buffer;
+  size_t size;
+  size_t used;
+};
+
+extern const struct ubasic_allocator ubasic_malloc_allocator;
+
+void ubasic_arena_init(struct ubasic_arena *arena, void *buffer, size_t size);
+void ubasic_arena_reset(struct ubasic_arena *arena);
+void ubasic_arena_allocator(struct ubasic_arena *arena,
+                            struct ubasic_allocator *allocator);
+
+#endif /* __ARENA_H__ */
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef __ARITH_H__
+#define __ARITH_H__
+
+/*
+ * Arithmetic on VARIABLE_TYPE, shared by the interpreter and the constant
+ * folding in the compiler so that both get the same results. Results wrap
+ * around on overflow unless UBASIC_OVERFLOW_TRAP is set; overflow then,
+ * and division by zero always, store a UBASIC_ERROR_* code in *error and
+ * return 0.
+ */
+
+#include "ubasic.h"
+#include "tokenizer.h"
+
+/* Build with -DUBASIC_OVERFLOW_TRAP=1 to stop programs whose arithmetic
+   overflows VARIABLE_TYPE instead of letting the result wrap around. */
+#ifndef UBASIC_OVERFLOW_TRAP
+#define UBASIC_OVERFLOW_TRAP 0
+#endif
+
+#if UBASIC_OVERFLOW_TRAP && !defined(__GNUC__)
+#error "UBASIC_OVERFLOW_TRAP needs the __builtin_*_overflow() functions"
+#endif
+
+/*---------------------------------------------------------------------------*/
+static inline VARIABLE_TYPE
+arith_error(int *error, int code)
+{
+  *error = code;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static inline VARIABLE_TYPE
+arith_add(VARIABLE_TYPE a, VARIABLE_TYPE b, int *error)
+{
+#if UBASIC_OVERFLOW_TRAP
+  VARIABLE_TYPE r;
+
+  if(__builtin_add_overflow(a, b, &r)) {
+    return arith_error(error, UBASIC_ERROR_OVERFLOW);
+  }
+  return r;
+#else
+  return (VARIABLE_TYPE)((uint64_t)a + (uint64_t)b);
+#endif
+}
+/*---------------------------------------------------------------------------*/
+static inline VARIABLE_TYPE
+arith_sub(VARIABLE_TYPE a, VARIABLE_TYPE b, int *error)
+{
+#if UBASIC_OVERFLOW_TRAP
+  VARIABLE_TYPE r;
+
+  if(__builtin_sub_overflow(a, b, &r)) {
+    return arith_error(error, UBASIC_ERROR_OVERFLOW);
+  }
+  return r;
+#else
+  return (VARIABLE_TYPE)((uint64_t)a - (uint64_t)b);
+#endif
+}
+/*---------------------------------------------------------------------------*/
+#ifdef VARIABLE_FIXED_SHIFT
+/* Fixed point products and quotients are worked out in 64 bits and
+   scaled back, so only a result that does not fit can overflow. */
+static inline VARIABLE_TYPE
+arith_mul(VARIABLE_TYPE a, VARIABLE_TYPE b, int *error)
+{
+  int64_t r;
+
+  r = ((int64_t)a * b) / ((int64_t)1 << VARIABLE_FIXED_SHIFT);
+#if UBASIC_OVERFLOW_TRAP
+  if(r < INT32_MIN || r > INT32_MAX) {
+    return arith_error(error, UBASIC_ERROR_OVERFLOW);
+  }
+#endif
+  return (VARIABLE_TYPE)r;
+}
+/*---------------------------------------------------------------------------*/
+static inline VARIABLE_TYPE
+arith_div(VARIABLE_TYPE a, VARIABLE_TYPE b, int *error)
+{
+  int64_t r;
+
+  if(b == 0) {
+    return arith_error(error, UBASIC_ERROR_DIVISION_BY_ZERO);
+  }
+  r = ((int64_t)a * ((int64_t)1 << VARIABLE_FIXED_SHIFT)) / b;
+#if UBASIC_OVERFLOW_TRAP
+  if(r < INT32_MIN || r > INT32_MAX) {
+    return arith_error(error, UBASIC_ERROR_OVERFLOW);
+  }
+#endif
+  return (VARIABLE_TYPE)r;
+}
+#else /* VARIABLE_FIXED_SHIFT */
+static inline VARIABLE_TYPE
+arith_mul(VARIABLE_TYPE a, VARIABLE_TYPE b, int *error)
+{
+#if UBASIC_OVERFLOW_TRAP
+  VARIABLE_TYPE r;
+
+  if(__builtin_mul_overflow(a, b, &r)) {
+    return arith_error(error, UBASIC_ERROR_OVERFLOW);
+  }
+  return r;
+#else
+  return (VARIABLE_TYPE)((uint64_t)a * (uint64_t)b);
+#endif
+}
+/*---------------------------------------------------------------------------*/
+static inline VARIABLE_TYPE
+arith_div(VARIABLE_TYPE a, VARIABLE_TYPE b, int *error)
+{
+  if(b == 0) {
+    return arith_error(error, UBASIC_ERROR_DIVISION_BY_ZERO);
+  }
+  if(b == -1) {
+    /* The smallest value divided by -1 does not fit. */
+    return arith_sub(0, a, error);
+  }
+  return a / b;
+}
+#endif /* VARIABLE_FIXED_SHIFT */
+/*---------------------------------------------------------------------------*/
+static inline VARIABLE_TYPE
+arith_mod(VARIABLE_TYPE a, VARIABLE_TYPE b, int *error)
+{
+  if(b == 0) {
+    return arith_error(error, UBASIC_ERROR_DIVISION_BY_ZERO);
+  }
+  if(b == -1) {
+    return 0;
+  }
+  return a % b;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Applies the operator token op, one of the arithmetic, logic or
+ * comparison tokens. Comparisons give VARIABLE_FROM_INT(1) for true.
+ */
+static inline VARIABLE_TYPE
+arith_binary(int op, VARIABLE_TYPE a, VARIABLE_TYPE b, int *error)
+{
+  switch(op) {
+  case TOKENIZER_PLUS:
+    return arith_add(a, b, error);
+  case TOKENIZER_MINUS:
+    return arith_sub(a, b, error);
+  case TOKENIZER_AND:
+    return a & b;
+  case TOKENIZER_OR:
+    return a | b;
+  case TOKENIZER_ASTR:
+    return arith_mul(a, b, error);
+  case TOKENIZER_SLASH:
+    return arith_div(a, b, error);
+  case TOKENIZER_MOD:
+    return arith_mod(a, b, error);
+  case TOKENIZER_LT:
+    return VARIABLE_FROM_INT(a < b);
+  case TOKENIZER_GT:
+    return VARIABLE_FROM_INT(a > b);
+  case TOKENIZER_EQ:
+    return VARIABLE_FROM_INT(a == b);
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+
+#endif /* __ARITH_H__ */
@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include "ubasic.h"
+#include "scheduler.h"
+
+/*
+ * Benchmarks for the tokenizer and the interpreter. Results are printed as
+ * a table and also written as one JSON object per line to the file named
+ * on the command line, bench_output.txt by default, so that runs can be
+ * compared by scripts.
+ *
+ * Every program benchmark sets up and runs its program PROGRAM_ROUNDS
+ * times. The Makefile links this with --wrap=malloc and friends, so that
+ * the allocations made by the interpreter can be counted.
+ */
+
+#define TOKENIZER_ROUNDS 20000
+#define PROGRAM_ROUNDS 10
+#define LARGE_PROGRAM_LINES 12000
+#define ARENA_SIZE (4 * 1024 * 1024)
+#define SCHEDULER_TASKS 4096
+
+/* MODE_ARENA is MODE_COMPILED with everything allocated from an arena
+   that is reset before every round. */
+enum {
+  MODE_TEXT,
+  MODE_COMPILED,
+  MODE_ARENA,
+  NUM_MODES
+};
+
+static const char *mode_names[NUM_MODES] = {
+  "text", "compiled", "arena"
+};
+
+static char arena_buffer[ARENA_SIZE];
+
+static const char program_tokens[] =
+"10 for i = 0 to 126\n\
+20 for j = 0 to 126\n\
+30 for k = 0 to 10\n\
+40 let a = i * j * k\n\
+rem 45 print a, i, j, k\n\
+50 next k\n\
+60 next j\n\
+70 next i\n\
+80 if a > 10 then print \"big\", a else print \"small\"\n\
+90 gosub 200\n\
+100 peek 100 + 20 + 3, z\n\
+110 poke (z - 1) % 7, a & 15 | 2\n\
+120 input 5, x\n\
+130 end\n\
+200 user \"user\"; x, y\n\
+210 return\n";
+
+static const char program_nested_for[] =
+"10 for i = 0 to 126\n\
+20 for j = 0 to 126\n\
+30 for k = 0 to 10\n\
+40 let a = i * j * k\n\
+50 next k\n\
+60 next j\n\
+70 next i\n\
+80 end\n";
+
+static const char program_gosub[] =
+"10 for i = 1 to 20000\n\
+20 gosub 100\n\
+30 next i\n\
+40 end\n\
+100 gosub 200\n\
+110 return\n\
+200 gosub 300\n\
+210 return\n\
+300 let a = a + 1\n\
+310 return\n";
+
+static const char program_goto_maze[] =
+"10 let n = 0\n\
+20 goto 90\n\
+30 goto 70\n\
+40 let n = n + 1\n\
+50 if n < 30000 then goto 20\n\
+60 end\n\
+70 goto 110\n\
+80 goto 40\n\
+90 goto 120\n\
+100 goto 80\n\
+110 goto 100\n\
+120 goto 30\n";
+
+static const char program_print[] =
+"10 for i = 1 to 20000\n\
+20 print \"line\", i, i * 2; i * 3\n\
+30 next i\n\
+40 end\n";
+
+static const char program_peek_poke[] =
+"10 for i = 1 to 30000\n\
+20 peek i, a\n\
+30 poke i, a + 1\n\
+40 peek a % 100, b\n\
+50 poke b, i\n\
+60 next i\n\
+70 end\n";
+
+static const char program_arrays[] =
+"10 dim a(99)\n\
+20 for r = 1 to 50\n\
+30 for i = 0 to 99\n\
+40 let a(i) = a(i) + i\n\
+50 next i\n\
+60 next r\n\
+70 end\n";
+
+static const char program_if_skip[] =
+"10 for i = 1 to 500\n\
+20 if i < 0 then print \"never printed, however many times\", i * 2 + 3 * i - 7, i / 3 + 100 * i, \"and then some\" else let a = a + 1\n\
+30 if i = 0 then let b = b + i * 3 + 7 * (i - 2) + (i * i) / 5 - 1000 + i * 9 - (i + 1) * (i + 2)\n\
+40 next i\n\
+50 end\n";
+
+static const char program_small[] =
+"10 for i = 1 to 200\n\
+20 let a = a + i\n\
+30 next i\n\
+40 end\n";
+
+static long allocations;
+static volatile VARIABLE_TYPE poke_sink;
+
+/*---------------------------------------------------------------------------*/
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *
+__wrap_malloc(size_t size)
+{
+  allocations++;
+  return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t size)
+{
+  allocations++;
+  return __real_calloc(nmemb, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+  allocations++;
+  return __real_realloc(ptr, size);
+}
+/*---------------------------------------------------------------------------*/
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+/*---------------------------------------------------------------------------*/
+static long
+peak_rss_kb(void)
+{
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE
+peek(VARIABLE_TYPE addr, void *context)
+{
+  return addr & 0x7f;
+}
+/*---------------------------------------------------------------------------*/
+static void
+poke(VARIABLE_TYPE addr, VARIABLE_TYPE value, void *context)
+{
+  poke_sink = addr + value;
+}
+/*---------------------------------------------------------------------------*/
+static char *
+large_program(void)
+{
+  char *program, *p;
+  int line;
+
+  /* A loop over more than 10000 lines, with a jump every 100 lines. */
+  program = malloc(LARGE_PROGRAM_LINES * 32);
+  p = program;
+  p += sprintf(p, "1 for r = 1 to 5\n");
+  for(line = 2; line < LARGE_PROGRAM_LINES; line++) {
+    if(line % 100 == 0) {
+      p += sprintf(p, "%d goto %d\n", line, line + 1);
+    } else {
+      p += sprintf(p, "%d let a = a + %d\n", line, line % 7);
+    }
+  }
+  p += sprintf(p, "%d next r\n", LARGE_PROGRAM_LINES);
+  p += sprintf(p, "%d end\n", LARGE_PROGRAM_LINES + 1);
+  return program;
+}
+/*---------------------------------------------------------------------------*/
+static void
+report(FILE *out, const char *name, const char *mode, long steps,
+       double elapsed, long allocs)
+{
+  printf("%-12s %-9s %10ld %12.0f %10.1f %8ld %8ld\n",
+         name, mode, steps, steps / elapsed, elapsed * 1e9 / steps,
+         allocs, peak_rss_kb());
+  fprintf(out, "{\"workload\": \"%s\", \"mode\": \"%s\", \"steps\": %ld, "
+          "\"seconds\": %.6f, \"steps_per_sec\": %.0f, "
+          "\"ns_per_step\": %.2f, \"allocations\": %ld, "
+          "\"peak_rss_kb\": %ld}\n",
+          name, mode, steps, elapsed, steps / elapsed,
+          elapsed * 1e9 / steps, allocs, peak_rss_kb());
+}
+/*---------------------------------------------------------------------------*/
+static void
+bench_tokenizer(FILE *out)
+{
+  ubasic_tokenizer_info tokenizer;
+  long tokens, allocs;
+  double start, elapsed;
+  int i;
+
+  allocs = allocations;
+  tokens = 0;
+  start = now();
+  for(i = 0; i < TOKENIZER_ROUNDS; i++) {
+    ubasic_tokenizer_init(&tokenizer, program_tokens);
+    while(!ubasic_tokenizer_finished(&tokenizer)) {
+      ubasic_tokenizer_next(&tokenizer);
+      tokens++;
+    }
+  }
+  elapsed = now() - start;
+
+  report(out, "tokenizer", "text", tokens, elapsed, allocations - allocs);
+}
+/*---------------------------------------------------------------------------*/
+static void
+bench_program(FILE *out, const char *name, const char *program, int mode)
+{
+  ubasic_info info;
+  struct ubasic_arena arena;
+  struct ubasic_allocator allocator;
+  long steps, allocs;
+  double start, elapsed;
+  int stdout_fd, null_fd;
+  int round;
+
+  /* Printed output goes to /dev/null, through the default print
+     functions. */
+  fflush(stdout);
+  stdout_fd = dup(1);
+  null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, 1);
+
+  ubasic_arena_init(&arena, arena_buffer, sizeof(arena_buffer));
+  ubasic_arena_allocator(&arena, &allocator);
+
+  allocs = allocations;
+  steps = 0;
+  start = now();
+
+  /* Setting up the interpreter is part of what is measured. */
+  for(round = 0; round < PROGRAM_ROUNDS; round++) {
+    if(mode == MODE_ARENA) {
+      ubasic_arena_reset(&arena);
+      ubasic_compile_with(&info, program, &allocator);
+    } else if(mode == MODE_COMPILED) {
+      ubasic_compile(&info, program);
+    } else {
+      ubasic_init(&info, program);
+    }
+    info.peek_function = peek;
+    info.poke_function = poke;
+    memset(info.variables, 0, sizeof(info.variables));
+
+    while(!ubasic_finished(&info)) {
+      steps += ubasic_run_until(&info, 10000);
+    }
+    ubasic_free(&info);
+  }
+
+  elapsed = now() - start;
+  allocs = allocations - allocs;
+
+  fflush(stdout);
+  dup2(stdout_fd, 1);
+  close(stdout_fd);
+  close(null_fd);
+
+  report(out, name, mode_names[mode], steps, elapsed, allocs);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Runs SCHEDULER_TASKS copies of a small compiled program on a scheduler
+ * with the given number of workers.
+ */
+static void
+bench_scheduler(FILE *out, int workers)
+{
+  static ubasic_info infos[SCHEDULER_TASKS];
+  struct ubasic_scheduler scheduler;
+  struct ubasic_program *program;
+  char mode[16];
+  long steps, allocs;
+  double start, elapsed;
+  int i;
+
+  program = ubasic_compiler_compile(program_small);
+  ubasic_init_program(&infos[0], program);
+  steps = 0;
+  while(!ubasic_finished(&infos[0])) {
+    steps += ubasic_run_until(&infos[0], 10000);
+  }
+  ubasic_free(&infos[0]);
+  steps *= SCHEDULER_TASKS;
+
+  allocs = allocations;
+  start = now();
+  ubasic_scheduler_init(&scheduler, SCHEDULER_TASKS, workers, NULL);
+  for(i = 0; i < SCHEDULER_TASKS; i++) {
+    ubasic_init_program(&infos[i], program);
+    ubasic_scheduler_add(&scheduler, &infos[i]);
+  }
+  ubasic_scheduler_run(&scheduler);
+  for(i = 0; i < SCHEDULER_TASKS; i++) {
+    ubasic_free(&infos[i]);
+  }
+  ubasic_scheduler_free(&scheduler);
+  elapsed = now() - start;
+  allocs = allocations - allocs;
+
+  ubasic_compiler_free(program);
+  snprintf(mode, sizeof(mode), "workers%d", workers);
+  report(out, "scheduler", mode, steps, elapsed, allocs);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char *argv[])
+{
+  const char *output_name;
+  char *program_large;
+  FILE *out;
+  int mode, cpus;
+
+  output_name = argc > 1 ? argv[1] : "bench_output.txt";
+  out = fopen(output_name, "w");
+  if(out == NULL) {
+    perror(output_name);
+    return 1;
+  }
+
+  program_large = large_program();
+
+  printf("%-12s %-9s %10s %12s %10s %8s %8s\n", "workload", "mode",
+         "steps", "steps/s", "ns/step", "allocs", "rss_kb");
+  bench_tokenizer(out);
+  for(mode = 0; mode < NUM_MODES; mode++) {
+    bench_program(out, "nested_for", program_nested_for, mode);
+    bench_program(out, "gosub", program_gosub, mode);
+    bench_program(out, "goto_maze", program_goto_maze, mode);
+    bench_program(out, "print", program_print, mode);
+    bench_program(out, "large", program_large, mode);
+    bench_program(out, "peek_poke", program_peek_poke, mode);
+    bench_program(out, "arrays", program_arrays, mode);
+    bench_program(out, "if_skip", program_if_skip, mode);
+  }
+  bench_scheduler(out, 1);
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if(cpus > 1) {
+    bench_scheduler(out, cpus);
+  }
+
+  free(program_large);
+  fclose(out);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,1265 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#define DEBUG 0
+
+#if DEBUG
+#define DEBUG_PRINTF(...)  printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINTF(...)
+#endif
+
+#include "compiler.h"
+#include "tokenizer.h"
+#include "arith.h"
+#include <string.h>
+#include <stdlib.h> /* qsort() */
+#include <limits.h> /* INT_MAX */
+
+/* Longest postfix form of an expression that gets compiled. */
+#define MAX_EXPR_OPS 64
+
+/* The most FOR loops that bounds checks are taken out of. */
+#define MAX_LOOPS 32
+
+struct expr_compiler {
+  const struct ubasic_code *code;
+  int pc;
+  struct ubasic_op ops[MAX_EXPR_OPS];
+  int num_ops;
+  int depth;
+  int failed;
+};
+
+/*
+ * Between first and last, the code of a FOR loop's body up to its NEXT,
+ * the loop variable var is known to stay between low and high.
+ */
+struct loop {
+  int var;
+  int first;
+  int last;
+  VARIABLE_TYPE low;
+  VARIABLE_TYPE high;
+};
+
+/*---------------------------------------------------------------------------*/
+static void scan(struct ubasic_program *program, const char *text,
+                 struct ubasic_text_index *index);
+static void then_ends(struct ubasic_text_index *index, int *pending, int pc,
+                      int pos);
+static int column(const char *text, const char *pos);
+static int line_compare(const void *a, const void *b);
+static size_t layout(struct ubasic_program *program,
+                     const struct ubasic_program *sizes);
+static size_t layout_exprs(struct ubasic_program *program, void *block,
+                           const struct ubasic_program *sizes);
+static void emit(struct expr_compiler *c, int op, VARIABLE_TYPE arg);
+static void element(struct expr_compiler *c);
+static void factor(struct expr_compiler *c);
+static void term(struct expr_compiler *c);
+static void expr(struct expr_compiler *c);
+static void relation(struct expr_compiler *c);
+static void classify(const struct expr_compiler *c, struct ubasic_expr *e);
+static int expression(struct ubasic_program *program, int pc,
+                      int whole_relation);
+static int next(const struct ubasic_code *code, int pc, int token);
+static int items(struct ubasic_program *program, int pc);
+static int statement(struct ubasic_program *program, int pc);
+static void expressions(struct ubasic_program *program);
+static void skips(struct ubasic_program *program);
+static int constant_size(const struct ubasic_program *program, int pc);
+static int constant(const struct ubasic_program *program, int pc,
+                    VARIABLE_TYPE *value);
+static int find_loop(const struct ubasic_program *program, int pc,
+                     struct loop *loop);
+static int in_bounds(const struct loop *loops, int num_loops, int pc,
+                     const struct ubasic_op *index, int size);
+static void hoist(struct ubasic_program *program);
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*
+ * Runs the tokenizer over the whole program text. When the code, columns,
+ * lines and strings arrays of the program are NULL only their sizes are
+ * computed, otherwise they are filled in as well. Lines point at their
+ * token in the code array or, for a text index, at their offset in the
+ * text, and then the args of the index are counted and, unless they are
+ * NULL, filled in too: the slots of long names and where a false IF
+ * carries on after each THEN, as the compiler gives them in the code.
+ */
+static void
+scan(struct ubasic_program *program, const char *text,
+     struct ubasic_text_index *index)
+{
+  ubasic_tokenizer_info tokenizer;
+  char const *prev_end;
+  char const *string_end = NULL;
+  int token, prev_token;
+  int string_len;
+  int at_line_start;
+  int pending = 0;
+
+  program->code_len = 0;
+  program->num_lines = 0;
+  program->strings_len = 0;
+  program->symbols.num_names = 0;
+  if(index != NULL) {
+    index->num_args = 0;
+  }
+
+  ubasic_tokenizer_init(&tokenizer, text);
+  tokenizer.symbols = &program->symbols;
+  prev_end = text;
+  prev_token = TOKENIZER_CR;
+
+  for(;;) {
+    token = ubasic_tokenizer_token(&tokenizer);
+
+    /* A line starts after a CR token or wherever the tokenizer skipped
+       over a newline on its own, as it does for REM lines. */
+    at_line_start = prev_token == TOKENIZER_CR ||
+      memchr(prev_end, '\n', ubasic_tokenizer_pos(&tokenizer) - prev_end) != NULL;
+
+    if(token == TOKENIZER_STRING) {
+      string_end = strchr(ubasic_tokenizer_pos(&tokenizer) + 1, '"');
+      if(string_end == NULL) {
+        token = TOKENIZER_ERROR;
+      }
+    } else if(token == TOKENIZER_VARIABLE) {
+      /* A name that gets no slot cannot be run. */
+      if(ubasic_symbols_add(&program->symbols,
+                            ubasic_tokenizer_pos(&tokenizer),
+                            tokenizer.nextptr -
+                            ubasic_tokenizer_pos(&tokenizer)) < 0) {
+        token = TOKENIZER_ERROR;
+      } else if(index != NULL &&
+                tokenizer.nextptr - ubasic_tokenizer_pos(&tokenizer) > 1) {
+        if(index->args != NULL) {
+          index->args[index->num_args].pos =
+            ubasic_tokenizer_pos(&tokenizer) - text;
+          index->args[index->num_args].arg =
+            ubasic_tokenizer_variable_num(&tokenizer);
+        }
+        index->num_args++;
+      }
+    }
+
+    if(index != NULL && token == TOKENIZER_THEN) {
+      if(index->args != NULL) {
+        index->args[index->num_args].pos =
+          ubasic_tokenizer_pos(&tokenizer) - text;
+        index->args[index->num_args].arg = -1 - program->code_len;
+      }
+      index->num_args++;
+    } else if(index != NULL && index->args != NULL) {
+      /* The end of input ends every THEN clause, and an error leaves the
+         ones that are still open to be found while the program runs. */
+      if(token == TOKENIZER_ELSE || token == TOKENIZER_CR) {
+        then_ends(index, &pending, program->code_len,
+                  ubasic_tokenizer_pos(&tokenizer) - text);
+      } else if(token == TOKENIZER_ENDOFINPUT) {
+        then_ends(index, &pending, INT_MAX,
+                  ubasic_tokenizer_pos(&tokenizer) - text);
+      } else if(token == TOKENIZER_ERROR) {
+        then_ends(index, &pending, INT_MAX, -1);
+      }
+    }
+
+    if(token == TOKENIZER_NUMBER && at_line_start) {
+      if(program->lines != NULL) {
+        program->lines[program->num_lines].line_number =
+          ubasic_tokenizer_num(&tokenizer);
+        program->lines[program->num_lines].pc = index != NULL ?
+          ubasic_tokenizer_pos(&tokenizer) - text : program->code_len;
+      }
+      program->num_lines++;
+    }
+
+    if(program->columns != NULL) {
+      program->columns[program->code_len] =
+        column(text, ubasic_tokenizer_pos(&tokenizer));
+    }
+    if(program->code != NULL) {
+      program->code[program->code_len].token = token;
+      program->code[program->code_len].arg = 0;
+      if(token == TOKENIZER_NUMBER) {
+        program->code[program->code_len].arg = ubasic_tokenizer_num(&tokenizer);
+      } else if(token == TOKENIZER_VARIABLE) {
+        program->code[program->code_len].arg =
+          ubasic_tokenizer_variable_num(&tokenizer);
+      } else if(token == TOKENIZER_STRING) {
+        program->code[program->code_len].arg = program->strings_len;
+      }
+    }
+    program->code_len++;
+
+    if(token == TOKENIZER_STRING) {
+      string_len = string_end - ubasic_tokenizer_pos(&tokenizer) - 1;
+      if(program->strings != NULL) {
+        memcpy(program->strings + program->strings_len,
+               ubasic_tokenizer_pos(&tokenizer) + 1, string_len);
+        program->strings[program->strings_len + string_len] = 0;
+      }
+      program->strings_len += string_len + 1;
+    }
+
+    if(token == TOKENIZER_ENDOFINPUT) {
+      break;
+    }
+    if(token == TOKENIZER_ERROR) {
+      /* The tokenizer cannot get past an error, so neither can we. */
+      DEBUG_PRINTF("scan: tokenizer error at '%s'\n",
+                   ubasic_tokenizer_pos(&tokenizer));
+      if(program->code != NULL) {
+        program->code[program->code_len].token = TOKENIZER_ENDOFINPUT;
+        program->code[program->code_len].arg = 0;
+      }
+      if(program->columns != NULL) {
+        program->columns[program->code_len] =
+          program->columns[program->code_len - 1];
+      }
+      program->code_len++;
+      break;
+    }
+
+    prev_token = token;
+    prev_end = tokenizer.nextptr;
+    ubasic_tokenizer_next(&tokenizer);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Gives the THENs of a text index that are waiting for the end of their
+ * clause the position pos of the stop token at index pc, if it is far
+ * enough after them, see skips(). Until then their arg is -1 minus their
+ * own index, and pending is the first of them.
+ */
+static void
+then_ends(struct ubasic_text_index *index, int *pending, int pc, int pos)
+{
+  struct ubasic_text_arg *arg;
+  int i;
+
+  for(i = *pending; i < index->num_args; i++) {
+    arg = &index->args[i];
+    if(arg->arg < 0 && -1 - arg->arg <= pc - 2) {
+      arg->arg = pos;
+    }
+  }
+  while(*pending < index->num_args && index->args[*pending].arg >= 0) {
+    (*pending)++;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* Columns count from 1. */
+static int
+column(const char *text, const char *pos)
+{
+  const char *start;
+
+  for(start = pos; start > text && start[-1] != '\n'; start--);
+  return pos - start + 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+line_compare(const void *a, const void *b)
+{
+  const struct ubasic_line *la = a;
+  const struct ubasic_line *lb = b;
+
+  if(la->line_number != lb->line_number) {
+    return la->line_number < lb->line_number ? -1 : 1;
+  }
+  /* Keep the first of several lines with the same number in front. */
+  return la->pc < lb->pc ? -1 : la->pc > lb->pc;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * A program takes two allocations: one for the program header, the code,
+ * the columns, the lines and the strings, and one for the expressions and their ops,
+ * which can only be counted once the code is there. layout() and
+ * layout_exprs() set up the pointers of program into them, if there is
+ * a program, for the sizes in sizes and return the size of the block.
+ */
+static size_t
+layout(struct ubasic_program *program, const struct ubasic_program *sizes)
+{
+  size_t code, columns, lines, strings, end;
+
+  code = sizeof(struct ubasic_program);
+  columns = code + sizes->code_len * sizeof(struct ubasic_code);
+  lines = columns + sizes->code_len * sizeof(int);
+  strings = lines + sizes->num_lines * sizeof(struct ubasic_line);
+  end = strings + sizes->strings_len;
+
+  if(program != NULL) {
+    program->code = (struct ubasic_code *)((char *)program + code);
+    program->columns = (int *)((char *)program + columns);
+    program->lines = (struct ubasic_line *)((char *)program + lines);
+    program->strings = (char *)program + strings;
+  }
+  return end;
+}
+/*---------------------------------------------------------------------------*/
+static size_t
+layout_exprs(struct ubasic_program *program, void *block,
+             const struct ubasic_program *sizes)
+{
+  size_t ops, end;
+
+  ops = sizes->num_exprs * sizeof(struct ubasic_expr);
+  end = ops + sizes->num_ops * sizeof(struct ubasic_op);
+
+  if(program != NULL) {
+    program->exprs = block;
+    program->ops = (struct ubasic_op *)((char *)block + ops);
+  }
+  return end;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Appends an op to the postfix form, folding operators whose operands are
+ * both constants. Folds that would fail are left for the interpreter, so
+ * that the error shows up when the expression is run.
+ */
+static void
+emit(struct expr_compiler *c, int op, VARIABLE_TYPE arg)
+{
+  struct ubasic_op *a;
+  VARIABLE_TYPE folded;
+  int error;
+
+  if(c->failed) {
+    return;
+  }
+  if(op == TOKENIZER_NUMBER || op == TOKENIZER_VARIABLE) {
+    if(++c->depth > UBASIC_EXPR_STACK_DEPTH) {
+      c->failed = 1;
+    }
+  } else if(op == UBASIC_OP_ELEMENT) {
+    /* The element takes the place of its index. */
+  } else if(op == UBASIC_OP_ELEMENT2) {
+    c->depth--;
+  } else {
+    c->depth--;
+    a = &c->ops[c->num_ops - 2];
+    if(a[0].op == TOKENIZER_NUMBER && a[1].op == TOKENIZER_NUMBER) {
+      error = UBASIC_ERROR_NONE;
+      folded = arith_binary(op, a[0].arg, a[1].arg, &error);
+      if(error == UBASIC_ERROR_NONE) {
+        a[0].arg = folded;
+        c->num_ops--;
+        return;
+      }
+    }
+  }
+
+  if(c->failed || c->num_ops == MAX_EXPR_OPS) {
+    c->failed = 1;
+    return;
+  }
+  c->ops[c->num_ops].op = op;
+  c->ops[c->num_ops].arg = arg;
+  c->num_ops++;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * factor(), term(), expr() and relation() follow the functions of the
+ * same name in ubasic.c, emitting ops instead of computing values.
+ */
+static void
+element(struct expr_compiler *c)
+{
+  int array, op;
+
+  array = c->code[c->pc].arg;
+  c->pc += 2;
+  expr(c);
+  op = UBASIC_OP_ELEMENT;
+  if(c->code[c->pc].token == TOKENIZER_COMMA) {
+    c->pc++;
+    expr(c);
+    op = UBASIC_OP_ELEMENT2;
+  }
+  if(c->code[c->pc].token != TOKENIZER_RIGHTPAREN) {
+    c->failed = 1;
+    return;
+  }
+  c->pc++;
+  emit(c, op, array);
+}
+/*---------------------------------------------------------------------------*/
+static void
+factor(struct expr_compiler *c)
+{
+  const struct ubasic_code *code;
+
+  code = &c->code[c->pc];
+  switch(code->token) {
+  case TOKENIZER_NUMBER:
+    emit(c, TOKENIZER_NUMBER, VARIABLE_FROM_INT(code->arg));
+    c->pc++;
+    break;
+  case TOKENIZER_VARIABLE:
+    if(code[1].token == TOKENIZER_LEFTPAREN) {
+      element(c);
+      break;
+    }
+    emit(c, TOKENIZER_VARIABLE, code->arg);
+    c->pc++;
+    break;
+  case TOKENIZER_LEFTPAREN:
+    c->pc++;
+    expr(c);
+    if(c->code[c->pc].token != TOKENIZER_RIGHTPAREN) {
+      c->failed = 1;
+      break;
+    }
+    c->pc++;
+    break;
+  default:
+    c->failed = 1;
+    break;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+term(struct expr_compiler *c)
+{
+  int op;
+
+  factor(c);
+  op = c->code[c->pc].token;
+  while(!c->failed &&
+        (op == TOKENIZER_ASTR ||
+         op == TOKENIZER_SLASH ||
+         op == TOKENIZER_MOD)) {
+    c->pc++;
+    factor(c);
+    emit(c, op, 0);
+    op = c->code[c->pc].token;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+expr(struct expr_compiler *c)
+{
+  int op;
+
+  term(c);
+  op = c->code[c->pc].token;
+  while(!c->failed &&
+        (op == TOKENIZER_PLUS ||
+         op == TOKENIZER_MINUS ||
+         op == TOKENIZER_AND ||
+         op == TOKENIZER_OR)) {
+    c->pc++;
+    term(c);
+    emit(c, op, 0);
+    op = c->code[c->pc].token;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+relation(struct expr_compiler *c)
+{
+  int op;
+
+  expr(c);
+  op = c->code[c->pc].token;
+  while(!c->failed &&
+        (op == TOKENIZER_LT ||
+         op == TOKENIZER_GT ||
+         op == TOKENIZER_EQ)) {
+    c->pc++;
+    expr(c);
+    emit(c, op, 0);
+    op = c->code[c->pc].token;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+classify(const struct expr_compiler *c, struct ubasic_expr *e)
+{
+  const struct ubasic_op *ops = c->ops;
+
+  e->kind = UBASIC_EXPR_POSTFIX;
+  e->end = c->pc;
+  e->var = 0;
+  e->var2 = 0;
+  e->value = 0;
+  e->first_op = 0;
+  e->num_ops = c->num_ops;
+
+  if(c->num_ops == 1) {
+    if(ops[0].op == TOKENIZER_NUMBER) {
+      e->kind = UBASIC_EXPR_CONST;
+      e->value = ops[0].arg;
+    } else {
+      e->kind = UBASIC_EXPR_VAR;
+      e->var = ops[0].arg;
+    }
+  } else if(c->num_ops == 3 && ops[0].op == TOKENIZER_VARIABLE) {
+    e->var = ops[0].arg;
+    e->var2 = ops[1].arg;
+    e->value = ops[1].arg;
+    if(ops[1].op == TOKENIZER_NUMBER) {
+      switch(ops[2].op) {
+      case TOKENIZER_PLUS:
+        e->kind = UBASIC_EXPR_VAR_ADD_CONST;
+        break;
+      case TOKENIZER_MINUS:
+        e->kind = UBASIC_EXPR_VAR_SUB_CONST;
+        break;
+      case TOKENIZER_LT:
+        e->kind = UBASIC_EXPR_VAR_LT_CONST;
+        break;
+      case TOKENIZER_GT:
+        e->kind = UBASIC_EXPR_VAR_GT_CONST;
+        break;
+      case TOKENIZER_EQ:
+        e->kind = UBASIC_EXPR_VAR_EQ_CONST;
+        break;
+      }
+    } else if(ops[1].op == TOKENIZER_VARIABLE && ops[2].op == TOKENIZER_ASTR) {
+      e->kind = UBASIC_EXPR_VAR_MUL_VAR;
+    }
+  }
+
+  if(e->kind != UBASIC_EXPR_POSTFIX) {
+    e->num_ops = 0;
+  }
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Compiles the expression, or with whole_relation set the relation, starting
+ * at pc and returns the pc after it, or -1 if it could not be compiled.
+ * Until the program has its exprs array only the expressions and their
+ * ops are counted.
+ */
+static int
+expression(struct ubasic_program *program, int pc, int whole_relation)
+{
+  struct expr_compiler c;
+  struct ubasic_expr e;
+
+  if(pc < 0) {
+    return -1;
+  }
+
+  c.code = program->code;
+  c.pc = pc;
+  c.num_ops = 0;
+  c.depth = 0;
+  c.failed = 0;
+  if(whole_relation) {
+    relation(&c);
+  } else {
+    expr(&c);
+  }
+  if(c.failed) {
+    DEBUG_PRINTF("expression: not compiling the expression at %d\n", pc);
+    return -1;
+  }
+
+  classify(&c, &e);
+  if(program->exprs != NULL) {
+    e.first_op = program->num_ops;
+    memcpy(program->ops + program->num_ops, c.ops,
+           e.num_ops * sizeof(struct ubasic_op));
+    program->exprs[program->num_exprs] = e;
+    program->code[pc].token = TOKENIZER_EXPR;
+    program->code[pc].arg = program->num_exprs;
+  }
+  program->num_exprs++;
+  program->num_ops += e.num_ops;
+  return c.pc;
+}
+/*---------------------------------------------------------------------------*/
+static int
+next(const struct ubasic_code *code, int pc, int token)
+{
+  if(pc < 0 || code[pc].token != token) {
+    return -1;
+  }
+  return pc + 1;
+}
+/*---------------------------------------------------------------------------*/
+/* The items of a PRINT or USER statement. */
+static int
+items(struct ubasic_program *program, int pc)
+{
+  for(;;) {
+    switch(program->code[pc].token) {
+    case TOKENIZER_STRING:
+    case TOKENIZER_COMMA:
+    case TOKENIZER_SEMICOLON:
+      pc++;
+      break;
+    case TOKENIZER_VARIABLE:
+    case TOKENIZER_NUMBER:
+      pc = expression(program, pc, 0);
+      if(pc < 0) {
+        return -1;
+      }
+      break;
+    default:
+      return pc;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Compiles the expressions of the statement at pc, following the
+ * statement functions in ubasic.c, and returns the pc after the
+ * statement, or -1 where it can't tell.
+ */
+static int
+statement(struct ubasic_program *program, int pc)
+{
+  const struct ubasic_code *code = program->code;
+
+  switch(code[pc].token) {
+  case TOKENIZER_LET:
+    pc++;
+    if(code[pc].token != TOKENIZER_VARIABLE) {
+      return -1;
+    }
+    /* Fall through. */
+  case TOKENIZER_VARIABLE:
+    pc++;
+    if(code[pc].token == TOKENIZER_LEFTPAREN) {
+      pc = expression(program, pc + 1, 0);
+      if(pc >= 0 && code[pc].token == TOKENIZER_COMMA) {
+        pc = expression(program, pc + 1, 0);
+      }
+      pc = next(code, pc, TOKENIZER_RIGHTPAREN);
+    }
+    return expression(program, next(code, pc, TOKENIZER_EQ), 0);
+  case TOKENIZER_DIM:
+    do {
+      pc = next(code, next(code, pc + 1, TOKENIZER_VARIABLE),
+                TOKENIZER_LEFTPAREN);
+      pc = expression(program, pc, 0);
+      if(pc >= 0 && code[pc].token == TOKENIZER_COMMA) {
+        pc = expression(program, pc + 1, 0);
+      }
+      pc = next(code, pc, TOKENIZER_RIGHTPAREN);
+    } while(pc >= 0 && code[pc].token == TOKENIZER_COMMA);
+    return pc;
+  case TOKENIZER_PRINT:
+  case TOKENIZER_USER:
+    return items(program, pc + 1);
+  case TOKENIZER_IF:
+    pc = next(code, expression(program, pc + 1, 1), TOKENIZER_THEN);
+    if(pc < 0) {
+      return -1;
+    }
+    pc = statement(program, pc);
+    if(pc >= 0 && code[pc].token == TOKENIZER_ELSE) {
+      pc = statement(program, pc + 1);
+    }
+    return pc;
+  case TOKENIZER_FOR:
+    pc = next(code, next(code, pc + 1, TOKENIZER_VARIABLE), TOKENIZER_EQ);
+    pc = next(code, expression(program, pc, 0), TOKENIZER_TO);
+    return expression(program, pc, 0);
+  case TOKENIZER_INPUT:
+    return expression(program, pc + 1, 0);
+  case TOKENIZER_PEEK:
+    /* A variable on its own is the target, anything else a count. */
+    pc = next(code, expression(program, pc + 1, 0), TOKENIZER_COMMA);
+    if(pc >= 0 && (code[pc].token != TOKENIZER_VARIABLE ||
+                   code[pc + 1].token != TOKENIZER_CR)) {
+      pc = next(code, expression(program, pc, 0), TOKENIZER_COMMA);
+    }
+    return next(code, pc, TOKENIZER_VARIABLE);
+  case TOKENIZER_POKE:
+    pc = next(code, expression(program, pc + 1, 0), TOKENIZER_COMMA);
+    pc = expression(program, pc, 0);
+    if(pc >= 0 && code[pc].token == TOKENIZER_COMMA) {
+      if(code[pc + 1].token == TOKENIZER_HASH) {
+        return next(code, pc + 2, TOKENIZER_VARIABLE);
+      }
+      pc = expression(program, pc + 1, 0);
+    }
+    return pc;
+  case TOKENIZER_GOTO:
+  case TOKENIZER_GOSUB:
+  case TOKENIZER_NEXT:
+    return pc + 2;
+  case TOKENIZER_RETURN:
+  case TOKENIZER_END:
+    return pc + 1;
+  }
+  return -1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+expressions(struct ubasic_program *program)
+{
+  int i;
+
+  program->num_exprs = 0;
+  program->num_ops = 0;
+  for(i = 0; i < program->num_lines; i++) {
+    statement(program, program->lines[i].pc + 1);
+  }
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Gives every THEN cell the position at which a false IF carries on: the
+ * first ELSE, end of line or end of input after the first token of the
+ * THEN clause, which is where the text interpreter gets to one token at
+ * a time. Going backwards, stop1 and stop2 are the first of those at or
+ * after pc + 1 and pc + 2.
+ */
+static void
+skips(struct ubasic_program *program)
+{
+  struct ubasic_code *code = program->code;
+  int pc, stop1, stop2, token;
+
+  stop1 = stop2 = program->code_len - 1;
+  for(pc = program->code_len - 1; pc >= 0; pc--) {
+    token = code[pc].token;
+    if(token == TOKENIZER_THEN) {
+      code[pc].arg = stop2;
+    }
+    stop2 = stop1;
+    if(token == TOKENIZER_ELSE || token == TOKENIZER_CR ||
+       token == TOKENIZER_ENDOFINPUT) {
+      stop1 = pc;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Returns the highest index that the size of a DIM at pc allows if it
+ * is a number on its own, or -1. The number is a NUMBER cell until the
+ * expressions are compiled and a constant expression after.
+ */
+static int
+constant_size(const struct ubasic_program *program, int pc)
+{
+  const struct ubasic_code *code = &program->code[pc];
+  VARIABLE_TYPE value;
+
+  if(code->token == TOKENIZER_NUMBER) {
+    return code->arg >= 0 && code->arg < INT_MAX ? code->arg : -1;
+  }
+  if(constant(program, pc, &value) != pc + 1 || value < 0) {
+    return -1;
+  }
+#if UBASIC_VARTYPE == UBASIC_VARTYPE_INT32 || \
+    UBASIC_VARTYPE == UBASIC_VARTYPE_INT64
+  /* Only plain 32 and 64-bit values can reach INT_MAX, which leaves no
+     room for the size. */
+  if(value >= (VARIABLE_TYPE)INT_MAX) {
+    return -1;
+  }
+#endif
+  return VARIABLE_TO_INT(value);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Finds the arrays that have exactly one DIM, with constant sizes, so
+ * that the interpreter can give them their storage before the program
+ * starts and every element access can rely on their sizes. The code has
+ * to end with ENDOFINPUT, but may come from an image.
+ */
+void
+ubasic_compiler_arrays(const struct ubasic_program *program,
+                       struct ubasic_dim *arrays, int *array_cells)
+{
+  const struct ubasic_code *code = program->code;
+  int dims[UBASIC_MAX_ARRAYS];
+  int sizes[2];
+  struct ubasic_dim *dim;
+  long long cells, total;
+  int pc, start, array, depth, commas;
+  int i;
+
+  memset(dims, 0, sizeof(dims));
+  memset(arrays, 0, UBASIC_MAX_ARRAYS * sizeof(struct ubasic_dim));
+
+  for(pc = 0; pc < program->code_len; pc++) {
+    if(code[pc].token != TOKENIZER_DIM) {
+      continue;
+    }
+    do {
+      pc++;
+      if(code[pc].token != TOKENIZER_VARIABLE ||
+         code[pc + 1].token != TOKENIZER_LEFTPAREN) {
+        break;
+      }
+      array = code[pc].arg;
+      if(array < 0 || array >= UBASIC_MAX_ARRAYS) {
+        break;
+      }
+      dims[array]++;
+
+      /* The sizes are constant if they are numbers on their own. */
+      start = pc + 2;
+      depth = 1;
+      commas = 0;
+      for(pc = start; depth > 0; pc++) {
+        if(code[pc].token == TOKENIZER_CR ||
+           code[pc].token == TOKENIZER_ENDOFINPUT) {
+          break;
+        } else if(code[pc].token == TOKENIZER_LEFTPAREN) {
+          depth++;
+        } else if(code[pc].token == TOKENIZER_RIGHTPAREN) {
+          depth--;
+        } else if(code[pc].token == TOKENIZER_COMMA && depth == 1) {
+          commas++;
+        }
+      }
+      if(depth > 0) {
+        dims[array]++;
+        break;
+      }
+      if(commas > 1 || pc - start != 2 + 2 * commas) {
+        dims[array]++;
+        continue;
+      }
+      for(i = 0; i <= commas; i++) {
+        sizes[i] = constant_size(program, start + 2 * i) + 1;
+        if(sizes[i] == 0) {
+          dims[array]++;
+        }
+      }
+      dim = &arrays[array];
+      dim->size1 = sizes[0];
+      dim->size2 = commas > 0 ? sizes[1] : 0;
+    } while(code[pc].token == TOKENIZER_COMMA);
+  }
+
+  total = 0;
+  for(array = 0; array < UBASIC_MAX_ARRAYS; array++) {
+    dim = &arrays[array];
+    cells = (long long)dim->size1 * (dim->size2 > 0 ? dim->size2 : 1);
+    if(dims[array] != 1 ||
+       total + cells > INT_MAX / (int)sizeof(VARIABLE_TYPE)) {
+      dim->size1 = 0;
+      dim->size2 = 0;
+      continue;
+    }
+    total += cells;
+  }
+  *array_cells = total;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * If the compiled expression at pc is a constant, stores it in value and
+ * returns the position after the expression, otherwise returns -1.
+ */
+static int
+constant(const struct ubasic_program *program, int pc, VARIABLE_TYPE *value)
+{
+  const struct ubasic_expr *e;
+
+  if(pc < 0 || program->code[pc].token != TOKENIZER_EXPR ||
+     program->exprs == NULL || program->code[pc].arg < 0 ||
+     program->code[pc].arg >= program->num_exprs) {
+    return -1;
+  }
+  e = &program->exprs[program->code[pc].arg];
+  if(e->kind != UBASIC_EXPR_CONST) {
+    return -1;
+  }
+  *value = e->value;
+  return e->end;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Checks whether the line at pc starts a FOR loop from one constant to
+ * another whose body can only be entered through the FOR and its NEXT,
+ * can only be left through the NEXT, has no loops of its own and does
+ * not change the loop variable, so that the variable stays between the
+ * two constants while the body runs. Host functions that change the
+ * variable are not accounted for.
+ */
+static int
+find_loop(const struct ubasic_program *program, int pc, struct loop *loop)
+{
+  const struct ubasic_code *code = program->code;
+  VARIABLE_TYPE from, to;
+  int target;
+
+  pc = next(code, pc + 1, TOKENIZER_FOR);
+  if(pc < 0 || code[pc].token != TOKENIZER_VARIABLE) {
+    return 0;
+  }
+  loop->var = code[pc].arg;
+  pc = constant(program, next(code, pc + 1, TOKENIZER_EQ), &from);
+  pc = constant(program, next(code, pc, TOKENIZER_TO), &to);
+  pc = next(code, pc, TOKENIZER_CR);
+  if(pc < 0) {
+    return 0;
+  }
+  loop->first = pc;
+  loop->low = from;
+  loop->high = to > from ? to : from;
+
+  for(; code[pc].token != TOKENIZER_NEXT ||
+        code[pc + 1].token != TOKENIZER_VARIABLE ||
+        code[pc + 1].arg != loop->var; pc++) {
+    switch(code[pc].token) {
+    case TOKENIZER_ENDOFINPUT:
+    case TOKENIZER_GOTO:
+    case TOKENIZER_GOSUB:
+    case TOKENIZER_RETURN:
+    case TOKENIZER_INPUT:
+    case TOKENIZER_PEEK:
+    /* The NEXT of another loop jumps back to its FOR, which can be
+       anywhere, and falls through if it names another variable. */
+    case TOKENIZER_FOR:
+    case TOKENIZER_NEXT:
+      return 0;
+    case TOKENIZER_VARIABLE:
+      if(code[pc].arg == loop->var && code[pc + 1].token == TOKENIZER_EQ) {
+        return 0;
+      }
+      break;
+    }
+  }
+  loop->last = pc;
+
+  /* The body has no jumps, so any jump into it comes from outside. */
+  for(pc = 0; pc < program->code_len; pc++) {
+    if((code[pc].token == TOKENIZER_GOTO ||
+        code[pc].token == TOKENIZER_GOSUB) &&
+       code[pc + 1].token == TOKENIZER_NUMBER) {
+      target = ubasic_compiler_find_line(program->lines, program->num_lines,
+                                         code[pc + 1].arg);
+      if(target >= loop->first && target <= loop->last) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Checks whether an index that is the single op index, found at pc, is
+ * always less than size.
+ */
+static int
+in_bounds(const struct loop *loops, int num_loops, int pc,
+          const struct ubasic_op *index, int size)
+{
+  VARIABLE_TYPE low, high;
+  int i;
+
+  if(index->op == TOKENIZER_NUMBER) {
+    low = high = index->arg;
+  } else if(index->op == TOKENIZER_VARIABLE) {
+    for(i = 0; i < num_loops; i++) {
+      if(loops[i].var == index->arg &&
+         loops[i].first <= pc && pc < loops[i].last) {
+        break;
+      }
+    }
+    if(i == num_loops) {
+      return 0;
+    }
+    low = loops[i].low;
+    high = loops[i].high;
+  } else {
+    return 0;
+  }
+  return low >= 0 && VARIABLE_TO_INT(high) < size;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Takes the bounds checks out of the element accesses, in expressions and
+ * on the left of assignments, whose indices are constants or variables
+ * of FOR loops that keep them within the array.
+ */
+static void
+hoist(struct ubasic_program *program)
+{
+  struct ubasic_code *code = program->code;
+  struct loop loops[MAX_LOOPS];
+  struct ubasic_op *ops, index[2];
+  const struct ubasic_expr *e;
+  const struct ubasic_dim *dim;
+  int num_loops, pc, start, end, n;
+  int i, k;
+
+  num_loops = 0;
+  for(i = 0; i < program->num_lines && num_loops < MAX_LOOPS; i++) {
+    if(find_loop(program, program->lines[i].pc, &loops[num_loops])) {
+      num_loops++;
+    }
+  }
+
+  for(pc = 0; pc < program->code_len; pc++) {
+    if(code[pc].token == TOKENIZER_EXPR) {
+      e = &program->exprs[code[pc].arg];
+      ops = program->ops + e->first_op;
+      for(k = 0; k < e->num_ops; k++) {
+        if(ops[k].op != UBASIC_OP_ELEMENT && ops[k].op != UBASIC_OP_ELEMENT2) {
+          continue;
+        }
+        /* An index that is a single op is all of the index. */
+        dim = &program->arrays[ops[k].arg];
+        if(ops[k].op == UBASIC_OP_ELEMENT && dim->size1 > 0 &&
+           dim->size2 == 0 &&
+           in_bounds(loops, num_loops, pc, &ops[k - 1], dim->size1)) {
+          ops[k].op = UBASIC_OP_ELEMENT_UNCHECKED;
+        } else if(ops[k].op == UBASIC_OP_ELEMENT2 && dim->size2 > 0 &&
+                  in_bounds(loops, num_loops, pc, &ops[k - 2], dim->size1) &&
+                  in_bounds(loops, num_loops, pc, &ops[k - 1], dim->size2)) {
+          ops[k].op = UBASIC_OP_ELEMENT2_UNCHECKED;
+        }
+      }
+      continue;
+    }
+
+    /* The target of an assignment is an array followed by its compiled
+       indices at the start of a statement. */
+    start = pc - 1;
+    if(code[pc].token != TOKENIZER_LEFTPAREN || start < 1 ||
+       code[start].token != TOKENIZER_VARIABLE ||
+       !(code[start - 1].token == TOKENIZER_LET ||
+         code[start - 1].token == TOKENIZER_THEN ||
+         code[start - 1].token == TOKENIZER_ELSE ||
+         (code[start - 1].token == TOKENIZER_NUMBER &&
+          (start == 1 || code[start - 2].token == TOKENIZER_CR)))) {
+      continue;
+    }
+    dim = &program->arrays[code[start].arg];
+    end = pc;
+    n = 0;
+    while(n < 2 && code[end + 1].token == TOKENIZER_EXPR) {
+      e = &program->exprs[code[end + 1].arg];
+      if(e->kind == UBASIC_EXPR_CONST) {
+        index[n].op = TOKENIZER_NUMBER;
+        index[n].arg = e->value;
+      } else if(e->kind == UBASIC_EXPR_VAR) {
+        index[n].op = TOKENIZER_VARIABLE;
+        index[n].arg = e->var;
+      } else {
+        break;
+      }
+      n++;
+      end = e->end;
+      if(code[end].token != TOKENIZER_COMMA) {
+        break;
+      }
+    }
+    if(code[end].token != TOKENIZER_RIGHTPAREN || dim->size1 == 0) {
+      continue;
+    }
+    if((n == 1 && dim->size2 == 0 &&
+        in_bounds(loops, num_loops, pc, &index[0], dim->size1)) ||
+       (n == 2 && dim->size2 > 0 &&
+        in_bounds(loops, num_loops, pc, &index[0], dim->size1) &&
+        in_bounds(loops, num_loops, pc, &index[1], dim->size2))) {
+      code[pc].arg = 1;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+struct ubasic_program *
+ubasic_compiler_compile(const char *text)
+{
+  return ubasic_compiler_compile_with(text, NULL);
+}
+/*---------------------------------------------------------------------------*/
+struct ubasic_program *
+ubasic_compiler_compile_with(const char *text,
+                             const struct ubasic_allocator *allocator)
+{
+  struct ubasic_program sizes;
+  struct ubasic_program *program;
+  size_t exprs_size;
+  void *exprs;
+
+  if(allocator == NULL) {
+    allocator = &ubasic_malloc_allocator;
+  }
+
+  memset(&sizes, 0, sizeof(sizes));
+  scan(&sizes, text, NULL);
+
+  program = allocator->alloc(layout(NULL, &sizes), allocator->context);
+  if(program == NULL) {
+    DEBUG_PRINTF("ubasic_compiler_compile: out of memory\n");
+    return NULL;
+  }
+  layout(program, &sizes);
+  program->allocator = *allocator;
+  scan(program, text, NULL);
+
+  program->exprs = NULL;
+  program->ops = NULL;
+  ubasic_compiler_arrays(program, program->arrays, &program->array_cells);
+  skips(program);
+  expressions(program);
+  exprs_size = layout_exprs(NULL, NULL, program);
+  exprs = allocator->alloc(exprs_size, allocator->context);
+  if(exprs == NULL && exprs_size > 0) {
+    DEBUG_PRINTF("ubasic_compiler_compile: out of memory\n");
+    allocator->free(program, allocator->context);
+    return NULL;
+  }
+  layout_exprs(program, exprs, program);
+  expressions(program);
+
+  qsort(program->lines, program->num_lines, sizeof(struct ubasic_line),
+        line_compare);
+  hoist(program);
+
+  DEBUG_PRINTF("ubasic_compiler_compile: %d tokens, %d lines, %d string bytes, %d expressions\n",
+               program->code_len, program->num_lines, program->strings_len,
+               program->num_exprs);
+  return program;
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_compiler_free(struct ubasic_program *program)
+{
+  struct ubasic_allocator allocator;
+
+  if(program == NULL) {
+    return;
+  }
+  allocator = program->allocator;
+  allocator.free(program->exprs, allocator.context);
+  allocator.free(program, allocator.context);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Builds the index of a program that is run as text, in a single
+ * allocation, and its symbol table if symbols is not NULL. Returns -1,
+ * with an empty index, if it could not be allocated.
+ */
+int
+ubasic_compiler_index(const char *text, struct ubasic_text_index *index,
+                      struct ubasic_symbols *symbols,
+                      const struct ubasic_allocator *allocator)
+{
+  struct ubasic_program sizes;
+  size_t size;
+
+  if(allocator == NULL) {
+    allocator = &ubasic_malloc_allocator;
+  }
+
+  memset(&sizes, 0, sizeof(sizes));
+  memset(index, 0, sizeof(*index));
+  scan(&sizes, text, index);
+
+  size = sizes.num_lines * sizeof(struct ubasic_line) +
+    index->num_args * sizeof(struct ubasic_text_arg);
+  sizes.lines = size > 0 ? allocator->alloc(size, allocator->context) : NULL;
+  if(sizes.lines == NULL && size > 0) {
+    DEBUG_PRINTF("ubasic_compiler_index: out of memory\n");
+    index->num_args = 0;
+    return -1;
+  }
+  if(size > 0) {
+    index->args = (struct ubasic_text_arg *)(sizes.lines + sizes.num_lines);
+  }
+  scan(&sizes, text, index);
+  if(symbols != NULL) {
+    *symbols = sizes.symbols;
+  }
+
+  /* The args come out in text order, but line numbers need not. */
+  qsort(sizes.lines, sizes.num_lines, sizeof(struct ubasic_line),
+        line_compare);
+
+  index->lines = sizes.lines;
+  index->num_lines = sizes.num_lines;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_compiler_index_free(struct ubasic_text_index *index,
+                           const struct ubasic_allocator *allocator)
+{
+  if(allocator == NULL) {
+    allocator = &ubasic_malloc_allocator;
+  }
+  if(index->lines != NULL) {
+    allocator->free(index->lines, allocator->context);
+  }
+  memset(index, 0, sizeof(*index));
+}
+/*---------------------------------------------------------------------------*/
+int
+ubasic_compiler_find_line(const struct ubasic_line *lines, int num_lines,
+                          int linenum)
+{
+  int low, high, mid;
+
+  low = 0;
+  high = num_lines;
+  while(low < high) {
+    mid = low + (high - low) / 2;
+    if(lines[mid].line_number < linenum) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if(low < num_lines && lines[low].line_number == linenum) {
+    return lines[low].pc;
+  }
+  return -1;
+}
+/*---------------------------------------------------------------------------*/
+int
+ubasic_compiler_find_arg(const struct ubasic_text_arg *args, int num_args,
+                         int pos)
+{
+  int low, high, mid;
+
+  low = 0;
+  high = num_args;
+  while(low < high) {
+    mid = low + (high - low) / 2;
+    if(args[mid].pos < pos) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if(low < num_args && args[low].pos == pos) {
+    return args[low].arg;
+  }
+  return -1;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef __COMPILER_H__
+#define __COMPILER_H__
+
+#include "vartype.h"
+#include "tokenizer.h"
+#include "arena.h"
+
+/*
+ * A compiled program is the token stream of a uBASIC program, lexed once
+ * up front. Every token becomes one ubasic_code cell; numbers carry their
+ * value, variables their index and strings an offset into the string
+ * pool, so the interpreter never has to look at the program text again.
+ * The opening parenthesis of an array element that is assigned to has
+ * arg 1 if the compiler has proved that its indices are in bounds, and
+ * THEN has the position at which the IF carries on if it is false.
+ */
+
+struct ubasic_code {
+  int token;
+  int arg;
+};
+
+/*
+ * Line tables are sorted by line number and searched with a binary search.
+ * pc is the index of the line number token in the code array, or the
+ * offset of the line number in the program text for tables built by
+ * ubasic_compiler_index().
+ */
+struct ubasic_line {
+  int line_number;
+  int pc;
+};
+
+/*
+ * Expressions are compiled once more, into postfix ops with constant
+ * subexpressions folded. The first cell of a compiled expression becomes
+ * a TOKENIZER_EXPR cell whose arg is the index of its ubasic_expr, and
+ * the interpreter evaluates that and carries on at end. The rest of the
+ * expression's cells are left in place, so that no position changes.
+ *
+ * The most common shapes are not run as postfix ops at all but have a
+ * kind of their own.
+ */
+enum {
+  UBASIC_EXPR_CONST,            /* value */
+  UBASIC_EXPR_VAR,              /* var */
+  UBASIC_EXPR_VAR_ADD_CONST,    /* var + value */
+  UBASIC_EXPR_VAR_SUB_CONST,    /* var - value */
+  UBASIC_EXPR_VAR_MUL_VAR,      /* var * var2 */
+  UBASIC_EXPR_VAR_LT_CONST,     /* var < value */
+  UBASIC_EXPR_VAR_GT_CONST,     /* var > value */
+  UBASIC_EXPR_VAR_EQ_CONST,     /* var = value */
+  UBASIC_EXPR_POSTFIX,          /* ops[first_op] to ops[first_op + num_ops] */
+};
+
+/* Expressions that need a deeper stack are left uncompiled. */
+#define UBASIC_EXPR_STACK_DEPTH 16
+
+/*
+ * A postfix op is TOKENIZER_NUMBER to push the value arg,
+ * TOKENIZER_VARIABLE to push variable arg, an operator token, or one of
+ * the ops below, which replace the index or the two indices on top of the
+ * stack with that element of array arg. The unchecked ones are used where
+ * the compiler has proved that the indices are in bounds.
+ */
+enum {
+  UBASIC_OP_ELEMENT = TOKENIZER_EXPR + 1,
+  UBASIC_OP_ELEMENT2,
+  UBASIC_OP_ELEMENT_UNCHECKED,
+  UBASIC_OP_ELEMENT2_UNCHECKED,
+};
+
+struct ubasic_op {
+  int op;
+  VARIABLE_TYPE arg;
+};
+
+struct ubasic_expr {
+  int kind;
+  int end;
+  int var;
+  int var2;
+  VARIABLE_TYPE value;
+  int first_op;
+  int num_ops;
+};
+
+/* Any variable can also name an array. */
+#define UBASIC_MAX_ARRAYS UBASIC_MAX_VARIABLES
+
+/*
+ * The number of elements along each dimension of an array, with size2 0
+ * for an array of one dimension.
+ */
+struct ubasic_dim {
+  int size1;
+  int size2;
+};
+
+struct ubasic_program {
+  struct ubasic_code *code;
+  int code_len;
+
+  /* The column of each code cell in the program text, for errors. */
+  int *columns;
+
+  struct ubasic_line *lines;
+  int num_lines;
+
+  struct ubasic_expr *exprs;
+  int num_exprs;
+
+  struct ubasic_op *ops;
+  int num_ops;
+
+  char *strings;
+  int strings_len;
+
+  /* The long variable names, which the code refers to by slot. */
+  struct ubasic_symbols symbols;
+
+  /* Arrays with a single DIM of constant size are given their storage
+     when the program starts, array_cells elements in all. The others
+     have size1 0 here. */
+  struct ubasic_dim arrays[UBASIC_MAX_ARRAYS];
+  int array_cells;
+
+  /* What the program and its exprs and ops were allocated with. */
+  struct ubasic_allocator allocator;
+};
+
+struct ubasic_program *ubasic_compiler_compile(const char *program);
+struct ubasic_program *
+ubasic_compiler_compile_with(const char *program,
+                             const struct ubasic_allocator *allocator);
+void ubasic_compiler_free(struct ubasic_program *program);
+void ubasic_compiler_arrays(const struct ubasic_program *program,
+                            struct ubasic_dim *arrays, int *array_cells);
+
+/*
+ * What a program that is run as text needs to find its way around: its
+ * line table, with the offset of each line number in the text for pc,
+ * and the arg that the compiler would give some of its tokens, sorted by
+ * the offset of the token in the text. These are the slots of the long
+ * variable names and, for THEN, the offset at which a false IF carries
+ * on, or -1 if the tokenizer found an error before it.
+ */
+struct ubasic_text_arg {
+  int pos;
+  int arg;
+};
+
+struct ubasic_text_index {
+  struct ubasic_line *lines;
+  int num_lines;
+
+  struct ubasic_text_arg *args;
+  int num_args;
+};
+
+int ubasic_compiler_index(const char *program, struct ubasic_text_index *index,
+                          struct ubasic_symbols *symbols,
+                          const struct ubasic_allocator *allocator);
+void ubasic_compiler_index_free(struct ubasic_text_index *index,
+                                const struct ubasic_allocator *allocator);
+int ubasic_compiler_find_line(const struct ubasic_line *lines, int num_lines,
+                              int linenum);
+int ubasic_compiler_find_arg(const struct ubasic_text_arg *args, int num_args,
+                             int pos);
+
+#endif /* __COMPILER_H__ */
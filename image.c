@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#define DEBUG 0
+
+#if DEBUG
+#define DEBUG_PRINTF(...)  printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINTF(...)
+#endif
+
+#include "image.h"
+#include <stdio.h>
+#include <string.h> /* memcmp(), memset() */
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char magic[3] = { 'u', 'B', 'I' };
+
+/* A loaded image is the program that interpreters run, pointing into the
+   mapping of the file. */
+struct image {
+  struct ubasic_program program;
+  void *map;
+  size_t size;
+};
+
+/*---------------------------------------------------------------------------*/
+static size_t align(size_t offset);
+static int put(FILE *file, size_t *pos, size_t offset, const void *data,
+               size_t len);
+static int section(const struct ubasic_image_header *header, uint32_t offset,
+                   uint32_t count, size_t size);
+static int valid(const struct ubasic_image_header *header, size_t size);
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static size_t
+align(size_t offset)
+{
+  return (offset + UBASIC_IMAGE_ALIGN - 1) & ~(size_t)(UBASIC_IMAGE_ALIGN - 1);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Writes len bytes at offset, padding with zeros from pos, which is where
+ * the file is now.
+ */
+static int
+put(FILE *file, size_t *pos, size_t offset, const void *data, size_t len)
+{
+  static const char zeros[UBASIC_IMAGE_ALIGN];
+
+  if(offset > *pos && fwrite(zeros, offset - *pos, 1, file) != 1) {
+    return -1;
+  }
+  if(len > 0 && fwrite(data, len, 1, file) != 1) {
+    return -1;
+  }
+  *pos = offset + len;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Saves a compiled program as an image at path, see image.h. Returns -1
+ * if it cannot be written or is too large for the format.
+ */
+int
+ubasic_save_image(const struct ubasic_program *program, const char *path)
+{
+  struct ubasic_image_header header;
+  size_t offset, pos;
+  FILE *file;
+  int error;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, magic, sizeof(magic));
+  header.version = UBASIC_IMAGE_VERSION;
+  header.byte_order = UBASIC_IMAGE_BYTE_ORDER;
+  header.value_size = sizeof(VARIABLE_TYPE);
+
+  offset = align(sizeof(header));
+  header.code = offset;
+  header.code_len = program->code_len;
+  offset = align(offset + program->code_len * sizeof(struct ubasic_code));
+  header.columns = offset;
+  offset = align(offset + program->code_len * sizeof(int));
+  header.lines = offset;
+  header.num_lines = program->num_lines;
+  offset = align(offset + program->num_lines * sizeof(struct ubasic_line));
+  header.exprs = offset;
+  header.num_exprs = program->num_exprs;
+  offset = align(offset + program->num_exprs * sizeof(struct ubasic_expr));
+  header.ops = offset;
+  header.num_ops = program->num_ops;
+  offset = align(offset + program->num_ops * sizeof(struct ubasic_op));
+  header.strings = offset;
+  header.strings_len = program->strings_len;
+  offset += program->strings_len;
+  if(offset > UINT32_MAX) {
+    DEBUG_PRINTF("ubasic_save_image: program too large\n");
+    return -1;
+  }
+  header.size = offset;
+
+  header.symbols = program->symbols;
+  memcpy(header.arrays, program->arrays, sizeof(header.arrays));
+  header.array_cells = program->array_cells;
+
+  file = fopen(path, "wb");
+  if(file == NULL) {
+    return -1;
+  }
+  pos = 0;
+  error = put(file, &pos, 0, &header, sizeof(header)) ||
+    put(file, &pos, header.code, program->code,
+        program->code_len * sizeof(struct ubasic_code)) ||
+    put(file, &pos, header.columns, program->columns,
+        program->code_len * sizeof(int)) ||
+    put(file, &pos, header.lines, program->lines,
+        program->num_lines * sizeof(struct ubasic_line)) ||
+    put(file, &pos, header.exprs, program->exprs,
+        program->num_exprs * sizeof(struct ubasic_expr)) ||
+    put(file, &pos, header.ops, program->ops,
+        program->num_ops * sizeof(struct ubasic_op)) ||
+    put(file, &pos, header.strings, program->strings, program->strings_len);
+  if(fclose(file) != 0) {
+    error = 1;
+  }
+  return error ? -1 : 0;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Whether count elements of size bytes each, starting at offset, are
+ * inside the image and aligned.
+ */
+static int
+section(const struct ubasic_image_header *header, uint32_t offset,
+        uint32_t count, size_t size)
+{
+  return offset % UBASIC_IMAGE_ALIGN == 0 && offset <= header->size &&
+    count <= (header->size - offset) / size;
+}
+/*---------------------------------------------------------------------------*/
+static int
+valid(const struct ubasic_image_header *header, size_t size)
+{
+  const char *image = (const char *)header;
+  const struct ubasic_code *last;
+  int i;
+
+  if(memcmp(header->magic, magic, sizeof(magic)) != 0 ||
+     header->version != UBASIC_IMAGE_VERSION ||
+     header->byte_order != UBASIC_IMAGE_BYTE_ORDER ||
+     header->value_size != sizeof(VARIABLE_TYPE) || header->size != size) {
+    DEBUG_PRINTF("ubasic_load_image: not an image for this build\n");
+    return 0;
+  }
+  if(header->code_len == 0 || header->code_len > INT32_MAX ||
+     !section(header, header->code, header->code_len,
+              sizeof(struct ubasic_code)) ||
+     !section(header, header->columns, header->code_len, sizeof(int)) ||
+     !section(header, header->lines, header->num_lines,
+              sizeof(struct ubasic_line)) ||
+     !section(header, header->exprs, header->num_exprs,
+              sizeof(struct ubasic_expr)) ||
+     !section(header, header->ops, header->num_ops,
+              sizeof(struct ubasic_op)) ||
+     !section(header, header->strings, header->strings_len, 1)) {
+    DEBUG_PRINTF("ubasic_load_image: truncated image\n");
+    return 0;
+  }
+
+  /* The interpreter stops at the end of the code and the end of each
+     string without looking at the size of either. */
+  last = (const struct ubasic_code *)(image + header->code) +
+    header->code_len - 1;
+  if(last->token != TOKENIZER_ENDOFINPUT ||
+     (header->strings_len > 0 &&
+      image[header->strings + header->strings_len - 1] != 0)) {
+    return 0;
+  }
+  if(header->symbols.num_names < 0 ||
+     header->symbols.num_names > UBASIC_MAX_VARIABLES - 26 ||
+     header->array_cells < 0) {
+    return 0;
+  }
+  for(i = 0; i < UBASIC_MAX_ARRAYS; i++) {
+    if(header->arrays[i].size1 < 0 || header->arrays[i].size2 < 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Maps the image at path and returns its program, which any number of
+ * interpreters can run with ubasic_init_program() until
+ * ubasic_image_free(). Returns NULL if the file cannot be mapped or is
+ * not an image for this build.
+ */
+const struct ubasic_program *
+ubasic_load_image(const char *path)
+{
+  const struct ubasic_image_header *header;
+  const struct ubasic_allocator *allocator = &ubasic_malloc_allocator;
+  struct ubasic_program *program;
+  struct ubasic_dim arrays[UBASIC_MAX_ARRAYS];
+  struct image *image;
+  struct stat st;
+  int array_cells;
+  char *map;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    return NULL;
+  }
+  if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*header) ||
+     st.st_size > UINT32_MAX) {
+    close(fd);
+    return NULL;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    return NULL;
+  }
+  header = (const struct ubasic_image_header *)map;
+  if(!valid(header, st.st_size)) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  image = allocator->alloc(sizeof(*image), allocator->context);
+  if(image == NULL) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  image->map = map;
+  image->size = st.st_size;
+
+  /* The interpreter never writes to a program, so it can run straight
+     from the read-only mapping. */
+  program = &image->program;
+  program->code = (struct ubasic_code *)(map + header->code);
+  program->code_len = header->code_len;
+  program->columns = (int *)(map + header->columns);
+  program->lines = (struct ubasic_line *)(map + header->lines);
+  program->num_lines = header->num_lines;
+  program->exprs = (struct ubasic_expr *)(map + header->exprs);
+  program->num_exprs = header->num_exprs;
+  program->ops = (struct ubasic_op *)(map + header->ops);
+  program->num_ops = header->num_ops;
+  program->strings = map + header->strings;
+  program->strings_len = header->strings_len;
+  program->symbols = header->symbols;
+  memcpy(program->arrays, header->arrays, sizeof(program->arrays));
+  program->array_cells = header->array_cells;
+  program->allocator = *allocator;
+
+  /* Element accesses rely on the sizes of the arrays that are given
+     their storage up front, so they have to be the ones in the code. */
+  ubasic_compiler_arrays(program, arrays, &array_cells);
+  if(memcmp(arrays, program->arrays, sizeof(arrays)) != 0 ||
+     array_cells != program->array_cells) {
+    DEBUG_PRINTF("ubasic_load_image: arrays do not match the code\n");
+    ubasic_image_free(program);
+    return NULL;
+  }
+
+  DEBUG_PRINTF("ubasic_load_image: %d tokens, %d lines from %s\n",
+               program->code_len, program->num_lines, path);
+  return program;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Unmaps an image loaded by ubasic_load_image(). No interpreter may still
+ * be running it.
+ */
+void
+ubasic_image_free(const struct ubasic_program *program)
+{
+  struct image *image = (struct image *)program;
+
+  if(image == NULL) {
+    return;
+  }
+  munmap(image->map, image->size);
+  image->program.allocator.free(image, image->program.allocator.context);
+}
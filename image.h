@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <stdint.h>
+
+#include "compiler.h"
+
+/*
+ * A program image is a compiled program saved to a file, so that it can
+ * be loaded without compiling it again. ubasic_load_image() maps the file
+ * read-only and points the program into the mapping, copying and checking
+ * nothing but the header, so that loading takes the same time for any
+ * size of program and processes that load the same image share its
+ * pages. Images are made by ubasic_save_image() or the ubasic-save-image
+ * tool.
+ *
+ * An image is the header below followed by the code, columns, lines,
+ * exprs, ops and strings of the program, each at the offset given in the
+ * header, which is a multiple of UBASIC_IMAGE_ALIGN. Everything is
+ * written in the byte order and struct layout of the machine that saved
+ * the image, and an image is only loaded by a build with the same byte
+ * order and VARIABLE_TYPE. Images are trusted like the programs they
+ * hold: the loader checks that every part is inside the file, not what
+ * the code says.
+ */
+
+#define UBASIC_IMAGE_VERSION 2
+#define UBASIC_IMAGE_ALIGN 16
+#define UBASIC_IMAGE_BYTE_ORDER 0x01020304
+
+struct ubasic_image_header {
+  char magic[3];                /* "uBI" */
+  uint8_t version;
+  uint32_t byte_order;
+  uint32_t value_size;
+  uint32_t size;                /* of the whole image */
+
+  uint32_t code;
+  uint32_t code_len;
+  uint32_t columns;
+  uint32_t lines;
+  uint32_t num_lines;
+  uint32_t exprs;
+  uint32_t num_exprs;
+  uint32_t ops;
+  uint32_t num_ops;
+  uint32_t strings;
+  uint32_t strings_len;
+
+  struct ubasic_symbols symbols;
+  struct ubasic_dim arrays[UBASIC_MAX_ARRAYS];
+  int32_t array_cells;
+};
+
+int ubasic_save_image(const struct ubasic_program *program, const char *path);
+const struct ubasic_program *ubasic_load_image(const char *path);
+void ubasic_image_free(const struct ubasic_program *program);
+
+#endif /* __IMAGE_H__ */
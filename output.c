@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#define DEBUG 0
+
+#if DEBUG
+#define DEBUG_PRINTF(...)  printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINTF(...)
+#endif
+
+#include "output.h"
+#include <string.h> /* memcpy() */
+#include <errno.h>
+#include <unistd.h> /* write() */
+
+/* Wide enough for the magnitude of any variable. */
+#if UBASIC_VARTYPE == UBASIC_VARTYPE_INT64
+typedef uint64_t magnitude_t;
+#else
+typedef uint32_t magnitude_t;
+#endif
+
+/* A sign and the digits of a 64 bit number, or of a Q16.16 number with
+   its decimals. */
+#define MAX_NUM_LEN 24
+
+/*---------------------------------------------------------------------------*/
+static void hand_on(struct ubasic_output *output, const char *data,
+                    size_t len);
+static char *format_digits(char *end, magnitude_t value);
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+void
+ubasic_output_init(struct ubasic_output *output, char *buffer, size_t size)
+{
+  output->buffer = buffer;
+  output->size = buffer != NULL ? size : 0;
+  output->used = 0;
+  output->write = NULL;
+  output->context = NULL;
+  output->fd = -1;
+  output->file = stdout;
+}
+/*---------------------------------------------------------------------------*/
+static void
+hand_on(struct ubasic_output *output, const char *data, size_t len)
+{
+  ssize_t written;
+
+  if(output->write != NULL) {
+    output->write(data, len, output->context);
+    return;
+  }
+  if(output->fd < 0) {
+    if(output->file != NULL) {
+      fwrite(data, 1, len, output->file);
+    }
+    return;
+  }
+  /* Output that cannot be written is dropped, as printf() would. */
+  while(len > 0) {
+    written = write(output->fd, data, len);
+    if(written < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      DEBUG_PRINTF("ubasic_output: write failed\n");
+      return;
+    }
+    data += written;
+    len -= written;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_output_flush(struct ubasic_output *output)
+{
+  if(output->used > 0) {
+    hand_on(output, output->buffer, output->used);
+    output->used = 0;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_output_write(struct ubasic_output *output, const char *data,
+                    size_t len)
+{
+  if(len > output->size - output->used) {
+    ubasic_output_flush(output);
+    if(len > output->size) {
+      hand_on(output, data, len);
+      return;
+    }
+  }
+  memcpy(output->buffer + output->used, data, len);
+  output->used += len;
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_output_char(struct ubasic_output *output, char c)
+{
+  if(output->used == output->size) {
+    ubasic_output_flush(output);
+    if(output->size == 0) {
+      hand_on(output, &c, 1);
+      return;
+    }
+  }
+  output->buffer[output->used++] = c;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Writes the decimal digits of value so that they end just before end, and
+ * returns where they start.
+ */
+static char *
+format_digits(char *end, magnitude_t value)
+{
+  do {
+    *--end = '0' + value % 10;
+    value /= 10;
+  } while(value != 0);
+  return end;
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_output_num(struct ubasic_output *output, VARIABLE_TYPE num)
+{
+  char text[MAX_NUM_LEN];
+  char *start, *end;
+  magnitude_t magnitude;
+
+  magnitude = num < 0 ? 0u - (magnitude_t)num : (magnitude_t)num;
+#ifdef VARIABLE_FIXED_SHIFT
+  {
+    magnitude_t mask = ((magnitude_t)1 << VARIABLE_FIXED_SHIFT) - 1;
+    uint64_t fraction;
+    int digits;
+
+    /* The integer part goes in front of room for the decimals. */
+    end = text + MAX_NUM_LEN - 6;
+    start = format_digits(end, magnitude >> VARIABLE_FIXED_SHIFT);
+    fraction = magnitude & mask;
+    if(fraction != 0) {
+      /* Five decimals are enough to tell any two Q16.16 values apart. */
+      *end++ = '.';
+      for(digits = 0; digits < 5 && fraction != 0; digits++) {
+        fraction *= 10;
+        *end++ = '0' + (int)(fraction >> VARIABLE_FIXED_SHIFT);
+        fraction &= mask;
+      }
+    }
+  }
+#else
+  end = text + MAX_NUM_LEN;
+  start = format_digits(end, magnitude);
+#endif
+  if(num < 0) {
+    *--start = '-';
+  }
+  ubasic_output_write(output, start, end - start);
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef __OUTPUT_H__
+#define __OUTPUT_H__
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "vartype.h"
+
+/*
+ * The output sink behind the default PRINT functions. Output collects in
+ * a buffer and is handed on in one piece when the buffer is full, at END,
+ * when the program stops and on ubasic_output_flush(): to the write
+ * function if there is one, otherwise to the file descriptor fd with
+ * write() if it is set, and otherwise to file, stdout unless set
+ * otherwise, with fwrite(). Going through stdio keeps PRINT output in
+ * order with the host's own printf() output. A sink without a buffer
+ * hands on everything straight away.
+ */
+
+typedef void (*ubasic_write_func)(const char *, size_t, void *);
+
+struct ubasic_output {
+  char *buffer;
+  size_t size;
+  size_t used;
+
+  ubasic_write_func write;
+  void *context;
+  int fd;
+  FILE *file;
+};
+
+void ubasic_output_init(struct ubasic_output *output, char *buffer,
+                        size_t size);
+void ubasic_output_flush(struct ubasic_output *output);
+void ubasic_output_write(struct ubasic_output *output, const char *data,
+                         size_t len);
+void ubasic_output_char(struct ubasic_output *output, char c);
+void ubasic_output_num(struct ubasic_output *output, VARIABLE_TYPE num);
+
+#endif /* __OUTPUT_H__ */
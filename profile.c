@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#define DEBUG 0
+
+#if DEBUG
+#define DEBUG_PRINTF(...)  printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINTF(...)
+#endif
+
+#include "profile.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FRAMES_INITIAL_SIZE 64
+
+/*---------------------------------------------------------------------------*/
+static uint64_t now(void);
+static int find_line(struct ubasic_profile *profile, int line_number);
+static unsigned frame_hash(struct ubasic_profile *profile, int parent,
+                           int line_number);
+static int frames_rehash(struct ubasic_profile *profile, int size);
+static int find_frame(struct ubasic_profile *profile, int parent,
+                      int line_number);
+static int line_compare(const void *a, const void *b);
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static uint64_t
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+/*---------------------------------------------------------------------------*/
+struct ubasic_profile *
+ubasic_profile_new(const struct ubasic_line *lines, int num_lines)
+{
+  struct ubasic_profile *profile;
+  int i;
+
+  profile = calloc(1, sizeof(struct ubasic_profile));
+  if(profile == NULL) {
+    return NULL;
+  }
+  profile->lines = calloc(num_lines + 1, sizeof(struct ubasic_profile_line));
+  profile->frames = malloc(FRAMES_INITIAL_SIZE *
+                           sizeof(struct ubasic_profile_frame));
+  if(profile->lines == NULL || profile->frames == NULL ||
+     frames_rehash(profile, 2 * FRAMES_INITIAL_SIZE) != 0) {
+    ubasic_profile_free(profile);
+    return NULL;
+  }
+
+  /* The line table is sorted by line number, so this one is too. */
+  for(i = 0; i < num_lines; i++) {
+    profile->lines[i].line_number = lines[i].line_number;
+  }
+  profile->num_lines = num_lines;
+
+  profile->frames_size = FRAMES_INITIAL_SIZE;
+  profile->frames[0].parent = -1;
+  profile->frames[0].line_number = 0;
+  profile->frames[0].line = -1;
+  profile->frames[0].time_ns = 0;
+  profile->num_frames = 1;
+
+  profile->current_frame = 0;
+  return profile;
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_profile_free(struct ubasic_profile *profile)
+{
+  if(profile != NULL) {
+    free(profile->lines);
+    free(profile->frames);
+    free(profile->frames_hash);
+    free(profile);
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+find_line(struct ubasic_profile *profile, int line_number)
+{
+  int low, high, mid;
+
+  low = 0;
+  high = profile->num_lines;
+  while(low < high) {
+    mid = low + (high - low) / 2;
+    if(profile->lines[mid].line_number < line_number) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if(low < profile->num_lines &&
+     profile->lines[low].line_number == line_number) {
+    return low;
+  }
+  return -1;
+}
+/*---------------------------------------------------------------------------*/
+static unsigned
+frame_hash(struct ubasic_profile *profile, int parent, int line_number)
+{
+  return ((unsigned)parent * 31 + (unsigned)line_number) * 2654435761u &
+    (profile->frames_hash_size - 1);
+}
+/*---------------------------------------------------------------------------*/
+static int
+frames_rehash(struct ubasic_profile *profile, int size)
+{
+  int *hash;
+  unsigned h;
+  int i;
+
+  hash = malloc(size * sizeof(int));
+  if(hash == NULL) {
+    return -1;
+  }
+  memset(hash, 0xff, size * sizeof(int));
+  free(profile->frames_hash);
+  profile->frames_hash = hash;
+  profile->frames_hash_size = size;
+
+  for(i = 1; i < profile->num_frames; i++) {
+    h = frame_hash(profile, profile->frames[i].parent,
+                   profile->frames[i].line_number);
+    while(hash[h] >= 0) {
+      h = (h + 1) & (size - 1);
+    }
+    hash[h] = i;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+find_frame(struct ubasic_profile *profile, int parent, int line_number)
+{
+  struct ubasic_profile_frame *frames;
+  struct ubasic_profile_frame *frame;
+  unsigned h;
+  int i;
+
+  h = frame_hash(profile, parent, line_number);
+  while((i = profile->frames_hash[h]) >= 0) {
+    if(profile->frames[i].parent == parent &&
+       profile->frames[i].line_number == line_number) {
+      return i;
+    }
+    h = (h + 1) & (profile->frames_hash_size - 1);
+  }
+
+  /* First time this line runs under this call stack. */
+  if(profile->num_frames == profile->frames_size) {
+    frames = realloc(profile->frames, 2 * profile->frames_size *
+                     sizeof(struct ubasic_profile_frame));
+    if(frames == NULL) {
+      return -1;
+    }
+    profile->frames = frames;
+    profile->frames_size *= 2;
+  }
+  i = profile->num_frames++;
+  frame = &profile->frames[i];
+  frame->parent = parent;
+  frame->line_number = line_number;
+  frame->line = find_line(profile, line_number);
+  frame->time_ns = 0;
+  profile->frames_hash[h] = i;
+
+  if(2 * profile->num_frames > profile->frames_hash_size) {
+    frames_rehash(profile, 2 * profile->frames_hash_size);
+  }
+  return i;
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_profile_line_begin(struct ubasic_profile *profile, int line_number)
+{
+  int depth, parent;
+
+  depth = profile->call_depth;
+  if(depth > PROFILE_MAX_DEPTH) {
+    depth = PROFILE_MAX_DEPTH;
+  }
+  parent = depth > 0 ? profile->call_stack[depth - 1] : 0;
+  profile->current_frame = find_frame(profile, parent, line_number);
+  if(profile->current_frame >= 0 &&
+     profile->frames[profile->current_frame].line >= 0) {
+    profile->lines[profile->frames[profile->current_frame].line].count++;
+  }
+  profile->line_start = now();
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_profile_line_end(struct ubasic_profile *profile)
+{
+  struct ubasic_profile_frame *frame;
+  uint64_t elapsed;
+
+  if(profile->current_frame < 0) {
+    return;
+  }
+  elapsed = now() - profile->line_start;
+  frame = &profile->frames[profile->current_frame];
+  frame->time_ns += elapsed;
+  if(frame->line >= 0) {
+    profile->lines[frame->line].time_ns += elapsed;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_profile_call(struct ubasic_profile *profile)
+{
+  /* Calls nested deeper than we can record are charged to the deepest
+     frame that fits. */
+  if(profile->call_depth < PROFILE_MAX_DEPTH) {
+    profile->call_stack[profile->call_depth] =
+      profile->current_frame >= 0 ? profile->current_frame : 0;
+  }
+  profile->call_depth++;
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_profile_return(struct ubasic_profile *profile)
+{
+  if(profile->call_depth > 0) {
+    profile->call_depth--;
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_profile_callback_begin(struct ubasic_profile *profile)
+{
+  profile->callback_start = now();
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_profile_callback_end(struct ubasic_profile *profile)
+{
+  int line;
+
+  if(profile->current_frame < 0) {
+    return;
+  }
+  line = profile->frames[profile->current_frame].line;
+  if(line >= 0) {
+    profile->lines[line].callback_ns += now() - profile->callback_start;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static int
+line_compare(const void *a, const void *b)
+{
+  const struct ubasic_profile_line *la = *(const struct ubasic_profile_line **)a;
+  const struct ubasic_profile_line *lb = *(const struct ubasic_profile_line **)b;
+
+  if(la->time_ns != lb->time_ns) {
+    return la->time_ns > lb->time_ns ? -1 : 1;
+  }
+  return la->line_number - lb->line_number;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Prints one row per line that ran, most expensive first.
+ */
+void
+ubasic_profile_dump(struct ubasic_profile *profile, FILE *out)
+{
+  struct ubasic_profile_line **sorted;
+  int i, n;
+
+  sorted = malloc((profile->num_lines + 1) *
+                  sizeof(struct ubasic_profile_line *));
+  if(sorted == NULL) {
+    return;
+  }
+  n = 0;
+  for(i = 0; i < profile->num_lines; i++) {
+    if(profile->lines[i].count > 0) {
+      sorted[n++] = &profile->lines[i];
+    }
+  }
+  qsort(sorted, n, sizeof(struct ubasic_profile_line *), line_compare);
+
+  fprintf(out, "%8s %12s %14s %14s %10s\n",
+          "line", "count", "time_ns", "callback_ns", "ns/run");
+  for(i = 0; i < n; i++) {
+    fprintf(out, "%8d %12lu %14llu %14llu %10llu\n",
+            sorted[i]->line_number, sorted[i]->count,
+            (unsigned long long)sorted[i]->time_ns,
+            (unsigned long long)sorted[i]->callback_ns,
+            (unsigned long long)(sorted[i]->time_ns / sorted[i]->count));
+  }
+  free(sorted);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Prints the time of every call path in the collapsed stack format that
+ * flamegraph.pl reads: the line numbers of the GOSUBs on the stack and of
+ * the line itself, separated by semicolons, followed by nanoseconds.
+ */
+void
+ubasic_profile_dump_collapsed(struct ubasic_profile *profile, FILE *out)
+{
+  int path[PROFILE_MAX_DEPTH + 1];
+  int depth;
+  int i, f;
+
+  for(i = 1; i < profile->num_frames; i++) {
+    if(profile->frames[i].time_ns == 0) {
+      continue;
+    }
+    depth = 0;
+    for(f = i; f > 0 && depth <= PROFILE_MAX_DEPTH;
+        f = profile->frames[f].parent) {
+      path[depth++] = profile->frames[f].line_number;
+    }
+    while(depth > 0) {
+      depth--;
+      fprintf(out, "%d%s", path[depth], depth > 0 ? ";" : "");
+    }
+    fprintf(out, " %llu\n", (unsigned long long)profile->frames[i].time_ns);
+  }
+}
+/*---------------------------------------------------------------------------*/
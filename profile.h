@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "compiler.h"
+
+/*
+ * The profiler counts how often each line runs and how much time it takes,
+ * both in total and inside host callbacks. Time is also attributed to the
+ * GOSUB call stack the line ran under, as a tree of frames with one node
+ * per call path, for flame graphs.
+ */
+
+#define PROFILE_MAX_DEPTH 64
+
+struct ubasic_profile_line {
+  int line_number;
+  unsigned long count;
+  uint64_t time_ns;
+  uint64_t callback_ns;
+};
+
+struct ubasic_profile_frame {
+  int parent;
+  int line_number;
+  int line;
+  uint64_t time_ns;
+};
+
+struct ubasic_profile {
+  struct ubasic_profile_line *lines;
+  int num_lines;
+
+  /* Frame 0 is the root; frames_hash maps (parent, line number) to a
+     frame, with -1 for empty buckets. */
+  struct ubasic_profile_frame *frames;
+  int num_frames;
+  int frames_size;
+  int *frames_hash;
+  int frames_hash_size;
+
+  int call_stack[PROFILE_MAX_DEPTH];
+  int call_depth;
+
+  int current_frame;
+  uint64_t line_start;
+  uint64_t callback_start;
+};
+
+struct ubasic_profile *ubasic_profile_new(const struct ubasic_line *lines,
+                                          int num_lines);
+void ubasic_profile_free(struct ubasic_profile *profile);
+
+void ubasic_profile_line_begin(struct ubasic_profile *profile,
+                               int line_number);
+void ubasic_profile_line_end(struct ubasic_profile *profile);
+void ubasic_profile_call(struct ubasic_profile *profile);
+void ubasic_profile_return(struct ubasic_profile *profile);
+void ubasic_profile_callback_begin(struct ubasic_profile *profile);
+void ubasic_profile_callback_end(struct ubasic_profile *profile);
+
+void ubasic_profile_dump(struct ubasic_profile *profile, FILE *out);
+void ubasic_profile_dump_collapsed(struct ubasic_profile *profile, FILE *out);
+
+#endif /* __PROFILE_H__ */
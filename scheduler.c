@@ -0,0 +1,407 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#define DEBUG 0
+
+#if DEBUG
+#define DEBUG_PRINTF(...)  printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINTF(...)
+#endif
+
+#include "scheduler.h"
+
+/*
+ * Locking: scheduler->lock protects the task states and the counts in
+ * the scheduler, and each worker's lock its queue. A worker's lock may
+ * be taken while holding the scheduler's, never the other way round.
+ */
+
+/*---------------------------------------------------------------------------*/
+static void enqueue(struct ubasic_scheduler *scheduler, int task,
+                    struct ubasic_worker *worker);
+static void push(struct ubasic_worker *worker, int task);
+static int pop(struct ubasic_worker *worker);
+static int steal(struct ubasic_worker *thief);
+static void run_slice(struct ubasic_worker *worker, int task);
+static void *work(void *arg);
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+/*
+ * Sets up a scheduler for up to max_tasks interpreters on num_workers
+ * threads, the calling thread included, allocated with allocator, or
+ * with malloc() if it is NULL. Returns -1 if there is not enough memory.
+ */
+int
+ubasic_scheduler_init(struct ubasic_scheduler *scheduler, int max_tasks,
+                      int num_workers,
+                      const struct ubasic_allocator *allocator)
+{
+  struct ubasic_worker *worker;
+  size_t tasks, queues, size;
+  char *block;
+  int i;
+
+  if(max_tasks < 0) {
+    return -1;
+  }
+  if(num_workers < 1) {
+    num_workers = 1;
+  }
+  scheduler->allocator = allocator != NULL ? *allocator :
+    ubasic_malloc_allocator;
+
+  /* The workers, the tasks and the queues share one allocation. */
+  tasks = num_workers * sizeof(struct ubasic_worker);
+  queues = tasks + max_tasks * sizeof(struct ubasic_task);
+  size = queues + (size_t)num_workers * max_tasks * sizeof(int);
+  block = scheduler->allocator.alloc(size, scheduler->allocator.context);
+  if(block == NULL) {
+    DEBUG_PRINTF("ubasic_scheduler_init: out of memory\n");
+    scheduler->workers = NULL;
+    return -1;
+  }
+
+  scheduler->workers = (struct ubasic_worker *)block;
+  scheduler->num_workers = num_workers;
+  scheduler->next_worker = 0;
+  scheduler->tasks = (struct ubasic_task *)(block + tasks);
+  scheduler->num_tasks = 0;
+  scheduler->max_tasks = max_tasks;
+  scheduler->slice = UBASIC_SCHEDULER_SLICE;
+  scheduler->queued = 0;
+  scheduler->runnable = 0;
+  scheduler->parked = 0;
+  pthread_mutex_init(&scheduler->lock, NULL);
+  pthread_cond_init(&scheduler->more_work, NULL);
+
+  for(i = 0; i < num_workers; i++) {
+    worker = &scheduler->workers[i];
+    worker->scheduler = scheduler;
+    pthread_mutex_init(&worker->lock, NULL);
+    worker->queue = (int *)(block + queues) + i * max_tasks;
+    worker->head = 0;
+    worker->len = 0;
+    worker->slices = 0;
+    worker->steals = 0;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Frees what the scheduler allocated. The interpreters are left alone.
+ */
+void
+ubasic_scheduler_free(struct ubasic_scheduler *scheduler)
+{
+  int i;
+
+  if(scheduler->workers == NULL) {
+    return;
+  }
+  for(i = 0; i < scheduler->num_workers; i++) {
+    pthread_mutex_destroy(&scheduler->workers[i].lock);
+  }
+  pthread_mutex_destroy(&scheduler->lock);
+  pthread_cond_destroy(&scheduler->more_work);
+  scheduler->allocator.free(scheduler->workers,
+                            scheduler->allocator.context);
+  scheduler->workers = NULL;
+  scheduler->tasks = NULL;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Adds an interpreter that has been set up with a program. Returns its
+ * task number, for ubasic_scheduler_park() and ubasic_scheduler_wake(),
+ * or -1 if the scheduler is full. Tasks can be added while the scheduler
+ * runs.
+ */
+int
+ubasic_scheduler_add(struct ubasic_scheduler *scheduler, ubasic_info *info)
+{
+  struct ubasic_task *task;
+  int n;
+
+  pthread_mutex_lock(&scheduler->lock);
+  if(scheduler->num_tasks == scheduler->max_tasks) {
+    pthread_mutex_unlock(&scheduler->lock);
+    return -1;
+  }
+  n = scheduler->num_tasks++;
+  task = &scheduler->tasks[n];
+  task->info = info;
+  task->park = 0;
+  task->resume = 0;
+  if(ubasic_finished(info)) {
+    task->state = UBASIC_TASK_FINISHED;
+  } else {
+    enqueue(scheduler, n, NULL);
+  }
+  pthread_mutex_unlock(&scheduler->lock);
+  return n;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Runs the tasks until every one of them has finished or is parked, and
+ * returns the number of parked tasks. Parked tasks that are woken later
+ * run on the next call.
+ */
+int
+ubasic_scheduler_run(struct ubasic_scheduler *scheduler)
+{
+  int started, i;
+
+  /* If a thread cannot be started the others take over its queue. */
+  started = 1;
+  for(i = 1; i < scheduler->num_workers; i++) {
+    if(pthread_create(&scheduler->workers[i].thread, NULL, work,
+                      &scheduler->workers[i]) != 0) {
+      break;
+    }
+    started++;
+  }
+  work(&scheduler->workers[0]);
+  for(i = 1; i < started; i++) {
+    pthread_join(scheduler->workers[i].thread, NULL);
+  }
+  return scheduler->parked;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Keeps a task from running until it is woken. A task that is running,
+ * for instance one that parks itself from one of its callbacks, is
+ * parked at the end of its slice. Can be called from any thread.
+ */
+void
+ubasic_scheduler_park(struct ubasic_scheduler *scheduler, int task)
+{
+  struct ubasic_task *t = &scheduler->tasks[task];
+
+  pthread_mutex_lock(&scheduler->lock);
+  if(t->state == UBASIC_TASK_RUNNABLE || t->state == UBASIC_TASK_RUNNING) {
+    t->park = 1;
+  }
+  pthread_mutex_unlock(&scheduler->lock);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Makes a parked task runnable again, or cancels a park that has not
+ * taken effect yet. Can be called from any thread.
+ */
+void
+ubasic_scheduler_wake(struct ubasic_scheduler *scheduler, int task)
+{
+  struct ubasic_task *t = &scheduler->tasks[task];
+
+  pthread_mutex_lock(&scheduler->lock);
+  t->park = 0;
+  if(t->state == UBASIC_TASK_PARKED) {
+    scheduler->parked--;
+    enqueue(scheduler, task, NULL);
+  }
+  pthread_mutex_unlock(&scheduler->lock);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Gives a task that is suspended the value it is waiting for and makes
+ * it runnable again. If it is still in the slice in which it suspended,
+ * that happens when the slice ends. Can be called from any thread.
+ */
+void
+ubasic_scheduler_resume(struct ubasic_scheduler *scheduler, int task,
+                        VARIABLE_TYPE value)
+{
+  struct ubasic_task *t = &scheduler->tasks[task];
+
+  pthread_mutex_lock(&scheduler->lock);
+  if(t->state == UBASIC_TASK_RUNNING) {
+    t->resume = 1;
+    t->value = value;
+  } else if(ubasic_suspended(t->info)) {
+    ubasic_resume(t->info, value);
+    if(t->state == UBASIC_TASK_PARKED) {
+      scheduler->parked--;
+      enqueue(scheduler, task, NULL);
+    }
+  }
+  pthread_mutex_unlock(&scheduler->lock);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Queues a task that was not runnable before, on worker or, if that is
+ * NULL, on the workers in turn. Called with the scheduler locked.
+ */
+static void
+enqueue(struct ubasic_scheduler *scheduler, int task,
+        struct ubasic_worker *worker)
+{
+  if(worker == NULL) {
+    worker = &scheduler->workers[scheduler->next_worker];
+    scheduler->next_worker = (scheduler->next_worker + 1) %
+      scheduler->num_workers;
+  }
+  scheduler->tasks[task].state = UBASIC_TASK_RUNNABLE;
+  scheduler->runnable++;
+  scheduler->queued++;
+  push(worker, task);
+  pthread_cond_signal(&scheduler->more_work);
+}
+/*---------------------------------------------------------------------------*/
+static void
+push(struct ubasic_worker *worker, int task)
+{
+  int max_tasks = worker->scheduler->max_tasks;
+
+  pthread_mutex_lock(&worker->lock);
+  worker->queue[(worker->head + worker->len) % max_tasks] = task;
+  worker->len++;
+  pthread_mutex_unlock(&worker->lock);
+}
+/*---------------------------------------------------------------------------*/
+static int
+pop(struct ubasic_worker *worker)
+{
+  int task;
+
+  pthread_mutex_lock(&worker->lock);
+  if(worker->len == 0) {
+    pthread_mutex_unlock(&worker->lock);
+    return -1;
+  }
+  task = worker->queue[worker->head];
+  worker->head = (worker->head + 1) % worker->scheduler->max_tasks;
+  worker->len--;
+  pthread_mutex_unlock(&worker->lock);
+  return task;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Takes the task at the tail of the first other worker's queue that has
+ * one, starting with the next worker.
+ */
+static int
+steal(struct ubasic_worker *thief)
+{
+  struct ubasic_scheduler *scheduler = thief->scheduler;
+  struct ubasic_worker *victim;
+  int first, i, task;
+
+  first = thief - scheduler->workers;
+  for(i = 1; i < scheduler->num_workers; i++) {
+    victim = &scheduler->workers[(first + i) % scheduler->num_workers];
+    pthread_mutex_lock(&victim->lock);
+    if(victim->len > 0) {
+      victim->len--;
+      task = victim->queue[(victim->head + victim->len) %
+                           scheduler->max_tasks];
+      pthread_mutex_unlock(&victim->lock);
+      thief->steals++;
+      return task;
+    }
+    pthread_mutex_unlock(&victim->lock);
+  }
+  return -1;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Runs one slice of a task that has been taken off a queue, and puts it
+ * back at the tail of the worker's queue unless it has finished or is to
+ * be parked.
+ */
+static void
+run_slice(struct ubasic_worker *worker, int task)
+{
+  struct ubasic_scheduler *scheduler = worker->scheduler;
+  struct ubasic_task *t = &scheduler->tasks[task];
+
+  pthread_mutex_lock(&scheduler->lock);
+  scheduler->queued--;
+  if(!t->park) {
+    t->state = UBASIC_TASK_RUNNING;
+    pthread_mutex_unlock(&scheduler->lock);
+
+    ubasic_run_until(t->info, scheduler->slice);
+    worker->slices++;
+
+    pthread_mutex_lock(&scheduler->lock);
+  }
+
+  scheduler->runnable--;
+  if(t->resume) {
+    t->resume = 0;
+    ubasic_resume(t->info, t->value);
+  }
+  if(ubasic_finished(t->info)) {
+    t->state = UBASIC_TASK_FINISHED;
+  } else if(t->park || ubasic_suspended(t->info)) {
+    t->park = 0;
+    t->state = UBASIC_TASK_PARKED;
+    scheduler->parked++;
+  } else {
+    enqueue(scheduler, task, worker);
+  }
+  if(scheduler->runnable == 0) {
+    /* Let the other workers know that they are done. */
+    pthread_cond_broadcast(&scheduler->more_work);
+  }
+  pthread_mutex_unlock(&scheduler->lock);
+}
+/*---------------------------------------------------------------------------*/
+static void *
+work(void *arg)
+{
+  struct ubasic_worker *worker = arg;
+  struct ubasic_scheduler *scheduler = worker->scheduler;
+  int task, done;
+
+  for(;;) {
+    task = pop(worker);
+    if(task < 0) {
+      task = steal(worker);
+    }
+    if(task >= 0) {
+      run_slice(worker, task);
+      continue;
+    }
+
+    /* Wait until there is something to take, or until the last task
+       has finished or been parked. */
+    pthread_mutex_lock(&scheduler->lock);
+    while(scheduler->queued == 0 && scheduler->runnable > 0) {
+      pthread_cond_wait(&scheduler->more_work, &scheduler->lock);
+    }
+    done = scheduler->runnable == 0;
+    pthread_mutex_unlock(&scheduler->lock);
+    if(done) {
+      return NULL;
+    }
+  }
+}
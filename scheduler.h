@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+#include <pthread.h>
+
+#include "ubasic.h"
+
+/*
+ * A scheduler runs many interpreters on a pool of worker threads. Every
+ * interpreter added to it becomes a task, which runs for at most slice
+ * lines at a time with ubasic_run_until() and then goes to the back of
+ * its worker's queue, so that no script can hold up the others, not even
+ * one that loops on a single line. A worker whose queue is empty steals
+ * tasks from the other workers.
+ *
+ * A parked task is not run until it is woken. Hosts park scripts that
+ * have to wait for something so that they take no worker time while
+ * they wait. A task that is suspended in INPUT or PEEK, see
+ * ubasic_suspend(), is parked until ubasic_scheduler_resume() gives it
+ * its value.
+ *
+ * An interpreter is only ever run by one worker at a time, but callbacks
+ * may be called on any of the workers.
+ */
+
+/* The number of lines a task runs before the next task gets its turn. */
+#define UBASIC_SCHEDULER_SLICE 1000
+
+enum {
+  UBASIC_TASK_RUNNABLE,
+  UBASIC_TASK_RUNNING,
+  UBASIC_TASK_PARKED,
+  UBASIC_TASK_FINISHED,
+};
+
+struct ubasic_task {
+  ubasic_info *info;
+  int state;
+  /* Set by ubasic_scheduler_park() while the task is queued or running,
+     and acted on before it runs again. */
+  int park;
+  /* Set by ubasic_scheduler_resume() while the task is running, and
+     passed on to ubasic_resume() when its slice ends. */
+  int resume;
+  VARIABLE_TYPE value;
+};
+
+/*
+ * Each worker's queue is a ring of task numbers with room for every
+ * task. The worker takes tasks from the head and puts them back at the
+ * tail; thieves take them from the tail.
+ */
+struct ubasic_worker {
+  struct ubasic_scheduler *scheduler;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  int *queue;
+  int head;
+  int len;
+  long slices;
+  long steals;
+};
+
+struct ubasic_scheduler {
+  struct ubasic_task *tasks;
+  int num_tasks;
+  int max_tasks;
+
+  struct ubasic_worker *workers;
+  int num_workers;
+  int next_worker;
+
+  int slice;
+
+  /* Protects the task states and the counts below. Workers with nothing
+     to do wait on more_work. */
+  pthread_mutex_t lock;
+  pthread_cond_t more_work;
+  int queued;
+  int runnable;
+  int parked;
+
+  struct ubasic_allocator allocator;
+};
+
+int ubasic_scheduler_init(struct ubasic_scheduler *scheduler, int max_tasks,
+                          int num_workers,
+                          const struct ubasic_allocator *allocator);
+void ubasic_scheduler_free(struct ubasic_scheduler *scheduler);
+int ubasic_scheduler_add(struct ubasic_scheduler *scheduler,
+                         ubasic_info *info);
+int ubasic_scheduler_run(struct ubasic_scheduler *scheduler);
+void ubasic_scheduler_park(struct ubasic_scheduler *scheduler, int task);
+void ubasic_scheduler_wake(struct ubasic_scheduler *scheduler, int task);
+void ubasic_scheduler_resume(struct ubasic_scheduler *scheduler, int task,
+                             VARIABLE_TYPE value);
+
+#endif /* __SCHEDULER_H__ */
@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#define DEBUG 0
+
+#if DEBUG
+#define DEBUG_PRINTF(...)  printf(__VA_ARGS__)
+#else
+#define DEBUG_PRINTF(...)
+#endif
+
+#include "snapshot.h"
+#include <stdint.h>
+#include <string.h> /* memset(), strlen() */
+
+static const unsigned char magic[3] = { 'u', 'B', 'S' };
+
+/* Writing counts the bytes that a snapshot takes even when they do not
+   fit; reading fails for good at the first one that is not there. */
+struct writer {
+  unsigned char *buf;
+  size_t size;
+  size_t len;
+};
+
+struct reader {
+  const unsigned char *buf;
+  size_t size;
+  size_t len;
+  int failed;
+};
+
+/*---------------------------------------------------------------------------*/
+static void put(struct writer *w, uint64_t value, int bytes);
+static void put_int(struct writer *w, int value);
+static void put_value(struct writer *w, VARIABLE_TYPE value);
+static uint64_t get(struct reader *r, int bytes);
+static int get_int(struct reader *r);
+static VARIABLE_TYPE get_value(struct reader *r);
+static int program_length(ubasic_info *info);
+static int position_valid(ubasic_info *info, int position);
+static int restore(ubasic_info *info, struct reader *r, int apply);
+/*---------------------------------------------------------------------------*/
+
+/*---------------------------------------------------------------------------*/
+static void
+put(struct writer *w, uint64_t value, int bytes)
+{
+  int i;
+
+  for(i = 0; i < bytes; i++) {
+    if(w->len < w->size) {
+      w->buf[w->len] = value >> (8 * i);
+    }
+    w->len++;
+  }
+}
+/*---------------------------------------------------------------------------*/
+static void
+put_int(struct writer *w, int value)
+{
+  put(w, (uint32_t)value, 4);
+}
+/*---------------------------------------------------------------------------*/
+static void
+put_value(struct writer *w, VARIABLE_TYPE value)
+{
+  put(w, (uint64_t)(int64_t)value, sizeof(VARIABLE_TYPE));
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+get(struct reader *r, int bytes)
+{
+  uint64_t value;
+  int i;
+
+  if(r->failed || r->size - r->len < (size_t)bytes) {
+    r->failed = 1;
+    return 0;
+  }
+  value = 0;
+  for(i = 0; i < bytes; i++) {
+    value |= (uint64_t)r->buf[r->len + i] << (8 * i);
+  }
+  r->len += bytes;
+  return value;
+}
+/*---------------------------------------------------------------------------*/
+static int
+get_int(struct reader *r)
+{
+  return (int32_t)(uint32_t)get(r, 4);
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE
+get_value(struct reader *r)
+{
+  uint64_t value;
+  int bits = 8 * sizeof(VARIABLE_TYPE);
+
+  value = get(r, sizeof(VARIABLE_TYPE));
+  /* Values are stored as many bytes as they have, so narrow ones have to
+     have their sign extended. */
+  if(bits < 64 && (value >> (bits - 1)) != 0) {
+    value |= ~(uint64_t)0 << bits;
+  }
+  return (VARIABLE_TYPE)(int64_t)value;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * The length of the program in tokens for a compiled program, or in
+ * characters for program text, which is all a snapshot has to go on to
+ * tell whether it was taken of the same program.
+ */
+static int
+program_length(ubasic_info *info)
+{
+  if(info->program != NULL) {
+    return info->program->code_len;
+  }
+  return strlen(info->program_ptr);
+}
+/*---------------------------------------------------------------------------*/
+static int
+position_valid(ubasic_info *info, int position)
+{
+  if(info->program != NULL) {
+    return position >= 0 && position < info->program->code_len;
+  }
+  return position >= 0 && position <= program_length(info);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Writes a snapshot of the interpreter to buf if it fits in size bytes,
+ * and returns the number of bytes it takes either way. Call it between
+ * runs, not from a callback.
+ */
+size_t
+ubasic_snapshot(ubasic_info *info, void *buf, size_t size)
+{
+  struct writer w;
+  int num_variables, num_arrays, i;
+
+  w.buf = buf;
+  w.size = buf != NULL ? size : 0;
+  w.len = 0;
+
+  put(&w, magic[0], 1);
+  put(&w, magic[1], 1);
+  put(&w, magic[2], 1);
+  put(&w, UBASIC_SNAPSHOT_VERSION, 1);
+  put(&w, sizeof(VARIABLE_TYPE), 1);
+  put(&w, info->program != NULL, 1);
+  put_int(&w, program_length(info));
+
+  if(info->program != NULL) {
+    put_int(&w, info->pc);
+  } else {
+    put_int(&w, ubasic_tokenizer_pos(&info->tokenizer_info) -
+            info->program_ptr);
+  }
+  put(&w, info->ended, 1);
+  put(&w, info->suspended, 1);
+  put_int(&w, info->suspended_var);
+  put_int(&w, info->error);
+  put_int(&w, info->error_line_number);
+  put_int(&w, info->error_column);
+
+  put_int(&w, info->gosub_stack_ptr);
+  for(i = 0; i < info->gosub_stack_ptr; i++) {
+    put_int(&w, info->gosub_stack[i]);
+  }
+  put_int(&w, info->for_stack_ptr);
+  for(i = 0; i < info->for_stack_ptr; i++) {
+    put_int(&w, info->for_stack[i].pos_after_for);
+    put_int(&w, info->for_stack[i].for_variable);
+    put_value(&w, info->for_stack[i].to);
+  }
+
+  /* Slots after the ones the program has names for are always 0. */
+  num_variables = 26;
+  if(info->symbols != NULL) {
+    num_variables += info->symbols->num_names;
+  }
+  put_int(&w, num_variables);
+  for(i = 0; i < num_variables; i++) {
+    put_value(&w, info->variables[i]);
+  }
+
+  put_int(&w, info->array_pool_used);
+  for(i = 0; i < info->array_pool_used; i++) {
+    put_value(&w, info->array_pool[i]);
+  }
+  num_arrays = 0;
+  for(i = 0; i < UBASIC_MAX_ARRAYS; i++) {
+    if(info->arrays[i].values != NULL) {
+      num_arrays++;
+    }
+  }
+  put_int(&w, num_arrays);
+  for(i = 0; i < UBASIC_MAX_ARRAYS; i++) {
+    if(info->arrays[i].values != NULL) {
+      put_int(&w, i);
+      put_int(&w, info->arrays[i].values - info->array_pool);
+      put_int(&w, info->arrays[i].size1);
+      put_int(&w, info->arrays[i].size2);
+      put_int(&w, info->arrays[i].capacity);
+    }
+  }
+
+  return w.len;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Reads a snapshot, checking everything in it against the interpreter,
+ * and changes the interpreter only if apply is set.
+ */
+static int
+restore(ubasic_info *info, struct reader *r, int apply)
+{
+  const struct ubasic_dim *dim;
+  struct ubasic_array *array;
+  struct ubasic_for_state *state;
+  int position, depth, num, used, slot, i;
+  int ended, suspended, suspended_var;
+  int offset, size1, size2, capacity;
+
+  if(get(r, 1) != magic[0] || get(r, 1) != magic[1] ||
+     get(r, 1) != magic[2] || get(r, 1) != UBASIC_SNAPSHOT_VERSION ||
+     get(r, 1) != sizeof(VARIABLE_TYPE) ||
+     get(r, 1) != (info->program != NULL) ||
+     get_int(r) != program_length(info)) {
+    DEBUG_PRINTF("restore: not a snapshot of this program\n");
+    return -1;
+  }
+
+  position = get_int(r);
+  ended = get(r, 1);
+  suspended = get(r, 1);
+  suspended_var = get_int(r);
+  if(!position_valid(info, position) || ended > 1 || suspended > 1 ||
+     (suspended && (suspended_var < 0 || suspended_var >= MAX_VARNUM))) {
+    return -1;
+  }
+  if(apply) {
+    if(info->program != NULL) {
+      info->pc = position;
+    } else {
+      ubasic_tokenizer_goto(&info->tokenizer_info,
+                            info->program_ptr + position);
+    }
+    info->ended = ended;
+    info->suspended = suspended;
+    info->suspended_var = suspended_var;
+    info->error = get_int(r);
+    info->error_line_number = get_int(r);
+    info->error_column = get_int(r);
+  } else {
+    get_int(r);
+    get_int(r);
+    get_int(r);
+  }
+
+  depth = get_int(r);
+  if(depth < 0 || depth > info->gosub_stack_depth) {
+    return -1;
+  }
+  for(i = 0; i < depth; i++) {
+    position = get_int(r);
+    if(!position_valid(info, position)) {
+      return -1;
+    }
+    if(apply) {
+      info->gosub_stack[i] = position;
+    }
+  }
+  if(apply) {
+    info->gosub_stack_ptr = depth;
+  }
+
+  depth = get_int(r);
+  if(depth < 0 || depth > info->for_stack_depth) {
+    return -1;
+  }
+  for(i = 0; i < depth; i++) {
+    position = get_int(r);
+    slot = get_int(r);
+    if(!position_valid(info, position) || slot < 0 || slot >= MAX_VARNUM) {
+      return -1;
+    }
+    state = &info->for_stack[i];
+    if(apply) {
+      state->pos_after_for = position;
+      state->for_variable = slot;
+      state->to = get_value(r);
+    } else {
+      get_value(r);
+    }
+  }
+  if(apply) {
+    info->for_stack_ptr = depth;
+  }
+
+  num = get_int(r);
+  if(num < 0 || num > MAX_VARNUM) {
+    return -1;
+  }
+  if(apply) {
+    memset(info->variables, 0, sizeof(info->variables));
+  }
+  for(i = 0; i < num; i++) {
+    if(apply) {
+      info->variables[i] = get_value(r);
+    } else {
+      get_value(r);
+    }
+  }
+
+  used = get_int(r);
+  if(used < 0 || used > info->array_pool_size) {
+    return -1;
+  }
+  for(i = 0; i < used; i++) {
+    if(apply) {
+      info->array_pool[i] = get_value(r);
+    } else {
+      get_value(r);
+    }
+  }
+  if(apply) {
+    info->array_pool_used = used;
+    memset(info->arrays, 0, sizeof(info->arrays));
+  }
+
+  num = get_int(r);
+  if(num < 0 || num > UBASIC_MAX_ARRAYS) {
+    return -1;
+  }
+  for(i = 0; i < num; i++) {
+    slot = get_int(r);
+    offset = get_int(r);
+    size1 = get_int(r);
+    size2 = get_int(r);
+    capacity = get_int(r);
+    if(slot < 0 || slot >= UBASIC_MAX_ARRAYS || offset < 0 ||
+       capacity < 0 || capacity > used - offset || size1 < 0 || size2 < 0 ||
+       size1 > capacity / (size2 > 0 ? size2 : 1)) {
+      return -1;
+    }
+    /* Element accesses in a compiled program rely on the sizes of the
+       arrays it gives their storage up front, which their DIM sets. */
+    dim = info->program != NULL ? &info->program->arrays[slot] : NULL;
+    if(dim != NULL && dim->size1 > 0 && (size1 > 0 || size2 > 0) &&
+       (size1 != dim->size1 || size2 != dim->size2)) {
+      return -1;
+    }
+    if(apply) {
+      array = &info->arrays[slot];
+      array->values = info->array_pool + offset;
+      array->size1 = size1;
+      array->size2 = size2;
+      array->capacity = capacity;
+    }
+  }
+
+  if(r->failed || r->len != r->size) {
+    return -1;
+  }
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Puts the interpreter in the state of a snapshot taken of an interpreter
+ * with the same program. Returns -1, leaving the interpreter as it was,
+ * if the snapshot is damaged, is of another program or a build with
+ * other variables, or does not fit in the interpreter's stacks or array
+ * pool.
+ */
+int
+ubasic_restore(ubasic_info *info, const void *buf, size_t size)
+{
+  struct reader r;
+
+  r.buf = buf;
+  r.size = size;
+  r.len = 0;
+  r.failed = 0;
+  if(restore(info, &r, 0) != 0) {
+    return -1;
+  }
+  r.len = 0;
+  return restore(info, &r, 1);
+}
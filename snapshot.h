@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stddef.h>
+
+#include "ubasic.h"
+
+/*
+ * A snapshot is the execution state of an interpreter: where it is in
+ * its program, its variables, arrays and GOSUB and FOR stacks, whether
+ * it has ended or is suspended, and its error. It can be restored into
+ * any interpreter set up with the same program, in the same thread or
+ * another one, any number of times.
+ *
+ * Snapshots are compact byte strings that do not depend on where
+ * anything is in memory: positions are offsets into the program. The
+ * program itself, the callbacks and buffered output are not part of a
+ * snapshot.
+ *
+ * Format, all numbers little endian, ints 4 bytes and values as many as
+ * the interpreter's VARIABLE_TYPE:
+ *
+ *   "uBS" version:1 value_size:1 compiled:1 program_length:4
+ *   position:4 ended:1 suspended:1 suspended_var:4
+ *   error:4 error_line_number:4 error_column:4
+ *   gosub_depth:4 position:4 * gosub_depth
+ *   for_depth:4 (position:4 variable:4 to:value) * for_depth
+ *   num_variables:4 value * num_variables
+ *   pool_used:4 value * pool_used
+ *   num_arrays:4 (array:4 offset:4 size1:4 size2:4 capacity:4) * num_arrays
+ */
+
+#define UBASIC_SNAPSHOT_VERSION 1
+
+size_t ubasic_snapshot(ubasic_info *info, void *buf, size_t size);
+int ubasic_restore(ubasic_info *info, const void *buf, size_t size);
+
+#endif /* __SNAPSHOT_H__ */
@@ -31,8 +31,23 @@
 
 #include <time.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include "ubasic.h"
+#include "scheduler.h"
+#include "snapshot.h"
+#include "image.h"
+
+#define STRESS_THREADS 8
+#define STRESS_RUNS 200
+#define SCHEDULER_TASKS 400
+#define SCHEDULER_WORKERS 4
+#define SUSPEND_TASKS 50
 
 static const char program_let[] =
 "10 let a = 42\n\
@@ -47,6 +62,12 @@ static const char program_goto[] =
 60 let c = 108\n\
 70 end\n";
 
+static const char program_goto_missing[] =
+"10 let a = 7\n\
+20 goto 100\n\
+30 let a = 1\n\
+40 end\n";
+
 static const char program_loop[] =
 "10 for i = 0 to 126\n\
 20 for j = 0 to 126\n\
@@ -68,6 +89,28 @@ rem 120 print a, b\n\
 140 next i\n\
 160 end\n";
 
+static const char program_gosub_if[] =
+"10 let s = 0\n\
+20 for i = 1 to 10\n\
+30 gosub 100\n\
+40 next i\n\
+50 end\n\
+100 if i > 5 then let s = s + i\n\
+110 return\n";
+
+/* A false IF carries on at the first ELSE, whichever IF it belongs to. */
+static const char program_if_else[] =
+"10 let a = 0\n\
+20 let b = 0\n\
+30 let c = 0\n\
+40 for i = 1 to 4\n\
+50 if i > 2 then let a = a + 1\n\
+60 if i > 2 then goto 70 else let b = b + 1\n\
+70 if i = 1 then if i = 2 then goto 90 else let c = c + 10\n\
+80 if i < 0 then print \"else\", i else let c = c + 1\n\
+90 next i\n\
+100 end\n";
+
 static const char program_peek_poke[] =
 "10 peek 100 + 20 + 3, a\n\
 20 peek 123, z\n\
@@ -75,21 +118,262 @@ static const char program_peek_poke[] =
 40 poke 0, 0\n\
 50 end\n";
 
+static const char program_threads[] =
+"10 let a = 0\n\
+20 for i = 1 to 20\n\
+30 gosub 100\n\
+40 next i\n\
+50 end\n\
+100 let a = a + i * s\n\
+110 return\n";
+
+static const char program_spin[] =
+"10 if a = 0 then goto 10\n\
+20 end\n";
+
+static const char program_park[] =
+"10 for i = 1 to 100\n\
+20 next i\n\
+30 poke 0, 0\n\
+40 end\n";
+
+static const char program_suspend[] =
+"10 input 1, a\n\
+20 peek 2, b\n\
+30 let c = a + b\n\
+40 if c > 0 then input 3, d\n\
+50 end\n";
+
+static const char program_batch[] =
+"10 let c = a * b + c\n\
+20 for i = 1 to 3\n\
+30 let c = c + i\n\
+40 next i\n\
+50 let runs = runs + 1\n\
+60 let r = runs\n\
+70 end\n";
+
+static const char program_exprs[] =
+"10 let a = 100 + 20 + 3\n\
+20 let b = (a - 3) / 4 * (2 + 1) % 7\n\
+30 if a = 123 then let c = a * a\n\
+40 if b > 5 then let d = 1\n\
+50 let e = a + 1 - b\n\
+60 end\n";
+
+static const char program_recursion[] =
+"10 let d = 0\n\
+20 gosub 100\n\
+30 end\n\
+100 let d = d + 1\n\
+110 if d < 50 then gosub 100\n\
+120 return\n";
+
+static const char program_nested_for[] =
+"5 let f = 0\n\
+10 for a = 1 to 2\n\
+20 for b = 1 to 2\n\
+30 for c = 1 to 2\n\
+40 for d = 1 to 2\n\
+50 for e = 1 to 2\n\
+60 let f = f + 1\n\
+70 next e\n\
+80 next d\n\
+90 next c\n\
+100 next b\n\
+110 next a\n\
+120 end\n";
+
+static const char program_syntax_error[] =
+"10 let a = 1\n\
+20 let b = * 2\n\
+30 let a = 2\n\
+40 end\n";
+
+static const char program_bad_statement[] =
+"10 let a = 3\n\
+20 then\n\
+30 end\n";
+
+static const char program_divide_by_zero[] =
+"10 let a = 1\n\
+20 let b = a / (a - 1)\n\
+30 let a = 2\n\
+40 end\n";
+
+static const char program_block[] =
+"10 let a = 1\n\
+20 poke 100, 40, 7\n\
+30 peek 99, a + 2, b\n\
+40 let e = 3\n\
+50 poke 200, 2, #d\n\
+60 peek 199, 4, w\n\
+70 peek 139, a, v\n\
+80 end\n";
+
+static const char program_block_range[] =
+"10 let a = 1\n\
+20 peek 0, 40, z\n\
+30 end\n";
+
+static const char program_block_name[] =
+"10 let sum = 1\n\
+20 poke 0, 1, #sum\n\
+30 end\n";
+
+#if UBASIC_VARTYPE == UBASIC_VARTYPE_INT64
+static const char program_block_count[] =
+"10 poke 0, 65536 * 65536, 1\n\
+20 end\n";
+#endif
+
+static const char program_arrays[] =
+"10 dim a(9), b(2, 3)\n\
+20 for i = 0 to 9\n\
+30 let a(i) = i * i\n\
+40 next i\n\
+50 for i = 0 to 2\n\
+60 for j = 0 to 3\n\
+70 let b(i, j) = i * 4 + j\n\
+80 next j\n\
+90 next i\n\
+100 let s = 0\n\
+110 for i = 0 to 9\n\
+120 let s = s + a(i)\n\
+130 next i\n\
+140 let t = b(2, 3) * 3 + a(s % 10)\n\
+150 end\n";
+
+static const char program_array_range[] =
+"10 dim a(3)\n\
+20 for i = 0 to 4\n\
+30 let a(i) = i\n\
+40 next i\n\
+50 end\n";
+
+static const char program_array_missing[] =
+"10 let a = b(0)\n\
+20 end\n";
+
+static const char program_array_memory[] =
+"10 let n = 9\n\
+20 dim a(n)\n\
+30 end\n";
+
+/* Arrays have no elements before their DIM, even where the compiler has
+   found the room for them and proved the indices to be in bounds. */
+static const char program_array_early[] =
+"10 let s = 0\n\
+20 goto 40\n\
+30 dim a(9), m(2, 3)\n\
+40 for i = 0 to 9\n\
+50 let s = s + a(i)\n\
+60 next i\n\
+70 end\n";
+
+/* NEXT i falls through into the body of the k loop, whose NEXT then
+   jumps back into that of the i loop with i out of bounds. */
+static const char program_array_loop_into[] =
+"5 dim a(3)\n\
+10 for i = 0 to 3\n\
+20 for k = 0 to 2\n\
+25 a(i) = 7\n\
+30 next i\n\
+35 i = 20000\n\
+40 next k\n\
+50 end\n";
+
+static const char program_array_early_let[] =
+"10 let m(1, 2) = 1\n\
+20 dim m(2, 3)\n\
+30 end\n";
+
+static const char program_names[] =
+"10 let sum = 0\n\
+20 for count = 1 to 10\n\
+30 let sum = sum + count\n\
+40 next count\n\
+50 let rest = sum - 5\n\
+60 dim values(3)\n\
+70 let values(2) = rest\n\
+80 let luck = values(2) + a\n\
+90 end\n";
+
+/* Keywords are found wherever they start, also inside a name. */
+static const char program_keywords[] =
+"10 let s=0\n\
+20 let b=6\n\
+30 fori=1to3\n\
+40 let s=s+i\n\
+50 nexti\n\
+60 goto80\n\
+70 let s=0\n\
+80 if s=bthen let count=s\n\
+90 end\n";
+
+static const char program_keyword_name[] =
+"10 let total = 1\n\
+20 end\n";
+
+static const char program_snapshot[] =
+"10 let sum = 0\n\
+20 dim v(9)\n\
+30 for i = 0 to 9\n\
+40 let v(i) = i * i\n\
+50 gosub 100\n\
+60 next i\n\
+70 end\n\
+100 let sum = sum + v(i)\n\
+110 return\n";
+
+static const char program_print[] =
+"10 print \"i\", 1; 0 - 25\n\
+20 for i = 1 to 3\n\
+30 print i * 1000\n\
+40 next i\n\
+50 end\n";
+
+#if UBASIC_VARTYPE == UBASIC_VARTYPE_FIXED
+static const char program_arith[] =
+"10 let a = 7 / 2\n\
+20 let b = a * a - 12\n\
+30 end\n";
+#elif UBASIC_VARTYPE != UBASIC_VARTYPE_INT16
+static const char program_arith[] =
+"10 let a = 999 * 999 * 2\n\
+20 let b = a / 3 - a\n\
+30 end\n";
+#endif
+
+static ubasic_info info;
+
 /*---------------------------------------------------------------------------*/
-VARIABLE_TYPE peek(VARIABLE_TYPE arg) {
+VARIABLE_TYPE peek(VARIABLE_TYPE arg, void *context) {
     return arg;
 }
 
 /*---------------------------------------------------------------------------*/
-void poke(VARIABLE_TYPE arg, VARIABLE_TYPE value) {
+void poke(VARIABLE_TYPE arg, VARIABLE_TYPE value, void *context) {
     assert(arg == value);
 }
 
 /*---------------------------------------------------------------------------*/
-void run(const char program[]) {
+enum {
+  MODE_TEXT,
+  MODE_COMPILED,
+  MODE_RUN_UNTIL,
+  NUM_MODES
+};
+
+static const char *mode_names[NUM_MODES] = {
+  "text", "compiled", "run_until"
+};
+
+/*---------------------------------------------------------------------------*/
+void run(const char program[], int mode) {
   static int test_num = 0;
   test_num++;
-  printf("Running test #%u... ", test_num);
+  printf("Running test #%u (%s)... ", test_num, mode_names[mode]);
   fflush(stdout);
 
   clock_t start_t, end_t;
@@ -97,11 +381,22 @@ void run(const char program[]) {
 
   start_t = clock();
 
-  ubasic_init_peek_poke(program, &peek, &poke);
+  if(mode == MODE_TEXT) {
+    ubasic_init(&info, program);
+  } else {
+    assert(ubasic_compile(&info, program) == 0);
+  }
+  info.peek_function = peek;
+  info.poke_function = poke;
 
-  do {
-    ubasic_run();
-  } while(!ubasic_finished());
+  if(mode == MODE_RUN_UNTIL) {
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_finished(&info));
+  } else {
+    do {
+      ubasic_run(&info);
+    } while(!ubasic_finished(&info));
+  }
 
   end_t = clock();
   delta_t = (double)(end_t - start_t) / CLOCKS_PER_SEC;
@@ -109,25 +404,1000 @@ void run(const char program[]) {
   printf("done. Run time: %.3f s\n", delta_t);
 }
 
+/*---------------------------------------------------------------------------*/
+void *stress_thread(void *arg) {
+  int thread_num = *(int *)arg;
+  ubasic_info thread_info;
+  int s;
+  int i;
+
+  for(i = 0; i < STRESS_RUNS; i++) {
+    s = (thread_num * 7 + i) % 100;
+    if(i % 2 == 0) {
+      ubasic_init(&thread_info, program_threads);
+    } else {
+      assert(ubasic_compile(&thread_info, program_threads) == 0);
+    }
+    ubasic_set_variable(&thread_info, 18, VARIABLE_FROM_INT(s));
+    while(ubasic_run_until(&thread_info, 7) == 7);
+    assert(ubasic_get_variable(&thread_info, 0) == VARIABLE_FROM_INT(210 * s));
+    ubasic_free(&thread_info);
+  }
+  return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+void run_threads(void) {
+  pthread_t threads[STRESS_THREADS];
+  int thread_nums[STRESS_THREADS];
+  int i;
+
+  printf("Running %d interpreters on %d threads... ",
+         STRESS_THREADS * STRESS_RUNS, STRESS_THREADS);
+  fflush(stdout);
+
+  for(i = 0; i < STRESS_THREADS; i++) {
+    thread_nums[i] = i;
+    assert(pthread_create(&threads[i], NULL, stress_thread,
+                          &thread_nums[i]) == 0);
+  }
+  for(i = 0; i < STRESS_THREADS; i++) {
+    assert(pthread_join(threads[i], NULL) == 0);
+  }
+
+  printf("done.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+struct request {
+  ubasic_info *info;
+  VARIABLE_TYPE addr;
+  int pending;
+};
+
+VARIABLE_TYPE suspend_input(VARIABLE_TYPE addr, void *context) {
+  struct request *request = context;
+
+  assert(!request->pending);
+  request->addr = addr;
+  request->pending = 1;
+  ubasic_suspend(request->info);
+  return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+void run_suspend(void) {
+  struct request request;
+  int compiled, requests;
+
+  printf("Running suspend and resume... ");
+  fflush(stdout);
+
+  for(compiled = 0; compiled < 2; compiled++) {
+    if(compiled) {
+      assert(ubasic_compile(&info, program_suspend) == 0);
+    } else {
+      ubasic_init(&info, program_suspend);
+    }
+    request.info = &info;
+    request.pending = 0;
+    info.app_context = &request;
+    info.input_function = suspend_input;
+    info.peek_function = suspend_input;
+
+    requests = 0;
+    while(!ubasic_finished(&info)) {
+      if(compiled) {
+        ubasic_run_until(&info, 1000);
+      } else {
+        ubasic_run(&info);
+      }
+      if(ubasic_suspended(&info)) {
+        assert(request.pending);
+        request.pending = 0;
+        requests++;
+        /* Nothing runs until the value is there. */
+        assert(ubasic_run_until(&info, 1000) == 0);
+        ubasic_resume(&info, request.addr * 10);
+      }
+    }
+    assert(requests == 3);
+    assert(ubasic_error(&info) == UBASIC_ERROR_NONE);
+    assert(ubasic_get_variable(&info, 0) == VARIABLE_FROM_INT(10));
+    assert(ubasic_get_variable(&info, 1) == VARIABLE_FROM_INT(20));
+    assert(ubasic_get_variable(&info, 2) == VARIABLE_FROM_INT(30));
+    assert(ubasic_get_variable(&info, 3) == VARIABLE_FROM_INT(30));
+    ubasic_free(&info);
+  }
+
+  printf("done.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+void setup_snapshot(ubasic_info *target, int compiled) {
+  if(compiled) {
+    assert(ubasic_compile(target, program_snapshot) == 0);
+  } else {
+    ubasic_init(target, program_snapshot);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+void finish_snapshot(ubasic_info *target) {
+  while(!ubasic_finished(target)) {
+    ubasic_run(target);
+  }
+  assert(ubasic_error(target) == UBASIC_ERROR_NONE);
+  assert(ubasic_get_variable(target, ubasic_variable_slot(target, "sum")) ==
+         VARIABLE_FROM_INT(285));
+}
+
+/*---------------------------------------------------------------------------*/
+void run_snapshot(void) {
+  static ubasic_info forks[2];
+  unsigned char buf[1024];
+  size_t len;
+  int compiled, i;
+
+  printf("Running snapshot and restore... ");
+  fflush(stdout);
+
+  for(compiled = 0; compiled < 2; compiled++) {
+    /* Stop in the first GOSUB, inside the FOR loop, with the array set
+       up. */
+    setup_snapshot(&info, compiled);
+    for(i = 0; i < 6; i++) {
+      ubasic_run(&info);
+    }
+    len = ubasic_snapshot(&info, NULL, 0);
+    assert(len > 0 && len <= sizeof(buf));
+    assert(ubasic_snapshot(&info, buf, len - 1) == len);
+    assert(ubasic_snapshot(&info, buf, sizeof(buf)) == len);
+    finish_snapshot(&info);
+    ubasic_free(&info);
+
+    /* The same snapshot starts any number of interpreters. */
+    for(i = 0; i < 2; i++) {
+      setup_snapshot(&forks[i], compiled);
+      assert(ubasic_restore(&forks[i], buf, len) == 0);
+      assert(ubasic_get_variable(&forks[i], 8) == 0);
+    }
+    for(i = 0; i < 2; i++) {
+      finish_snapshot(&forks[i]);
+      ubasic_free(&forks[i]);
+    }
+
+    /* A damaged snapshot, or one of another program, is refused. */
+    setup_snapshot(&forks[0], compiled);
+    assert(ubasic_restore(&forks[0], buf, len - 1) == -1);
+    buf[3]++;
+    assert(ubasic_restore(&forks[0], buf, len) == -1);
+    buf[3]--;
+    /* So is one that gives v, which the compiled program sets up as
+       dim v(9), another size. The record of v comes last, and its size1
+       is 12 bytes from the end. */
+    assert(buf[len - 12] == 10);
+    buf[len - 12] = 5;
+    assert(ubasic_restore(&forks[0], buf, len) == (compiled ? -1 : 0));
+    buf[len - 12] = 10;
+    ubasic_init(&forks[1], program_let);
+    assert(ubasic_restore(&forks[1], buf, len) == -1);
+    ubasic_free(&forks[1]);
+    ubasic_set_stack_depths(&forks[0], 0, MAX_FOR_STACK_DEPTH);
+    assert(ubasic_restore(&forks[0], buf, len) == -1);
+    ubasic_free(&forks[0]);
+  }
+
+  printf("done.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+void run_image(void) {
+  static ubasic_info infos[2];
+  struct ubasic_program *compiled;
+  const struct ubasic_program *program;
+  char path[] = "/tmp/ubasic-tests-XXXXXX";
+  int fd, size1, i;
+
+  printf("Running program images... ");
+  fflush(stdout);
+
+  fd = mkstemp(path);
+  assert(fd >= 0);
+  close(fd);
+  compiled = ubasic_compiler_compile(program_snapshot);
+  assert(compiled != NULL);
+  assert(ubasic_save_image(compiled, path) == 0);
+  ubasic_compiler_free(compiled);
+
+  /* Interpreters run the program from the read-only mapping. */
+  program = ubasic_load_image(path);
+  assert(program != NULL);
+  for(i = 0; i < 2; i++) {
+    ubasic_init_program(&infos[i], program);
+    finish_snapshot(&infos[i]);
+  }
+  for(i = 0; i < 2; i++) {
+    ubasic_free(&infos[i]);
+  }
+  ubasic_image_free(program);
+
+  /* An image whose arrays do not match its code is refused. */
+  fd = open(path, O_WRONLY);
+  assert(fd >= 0);
+  size1 = 5;
+  assert(pwrite(fd, &size1, sizeof(size1),
+                offsetof(struct ubasic_image_header, arrays) +
+                ('v' - 'a') * sizeof(struct ubasic_dim)) == sizeof(size1));
+  close(fd);
+  assert(ubasic_load_image(path) == NULL);
+
+  assert(truncate(path, 100) == 0);
+  assert(ubasic_load_image(path) == NULL);
+  unlink(path);
+  assert(ubasic_load_image(path) == NULL);
+
+  printf("done.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+void park_poke(VARIABLE_TYPE addr, VARIABLE_TYPE value, void *context) {
+  ubasic_scheduler_park(context, VARIABLE_TO_INT(value));
+}
+
+/*---------------------------------------------------------------------------*/
+void run_scheduler(void) {
+  static ubasic_info infos[SCHEDULER_TASKS];
+  struct request requests[SUSPEND_TASKS];
+  struct ubasic_scheduler scheduler;
+  int i, rounds;
+
+  printf("Running %d interpreters on a scheduler with %d workers... ",
+         SCHEDULER_TASKS, SCHEDULER_WORKERS);
+  fflush(stdout);
+
+  assert(ubasic_scheduler_init(&scheduler, SCHEDULER_TASKS,
+                               SCHEDULER_WORKERS, NULL) == 0);
+  scheduler.slice = 7;
+  for(i = 0; i < SCHEDULER_TASKS; i++) {
+    if(i % 2 == 0) {
+      ubasic_init(&infos[i], program_threads);
+    } else {
+      assert(ubasic_compile(&infos[i], program_threads) == 0);
+    }
+    ubasic_set_variable(&infos[i], 18, VARIABLE_FROM_INT(i % 100));
+    assert(ubasic_scheduler_add(&scheduler, &infos[i]) == i);
+  }
+  assert(ubasic_scheduler_add(&scheduler, &infos[0]) == -1);
+  assert(ubasic_scheduler_run(&scheduler) == 0);
+  for(i = 0; i < SCHEDULER_TASKS; i++) {
+    assert(ubasic_finished(&infos[i]));
+    assert(ubasic_get_variable(&infos[i], 0) ==
+           VARIABLE_FROM_INT(210 * (i % 100)));
+    ubasic_free(&infos[i]);
+  }
+  ubasic_scheduler_free(&scheduler);
+
+  /* A script that spins on one line does not keep the other from running
+     on the same worker, which then parks it. */
+  assert(ubasic_scheduler_init(&scheduler, 2, 1, NULL) == 0);
+  scheduler.slice = 10;
+  assert(ubasic_compile(&infos[0], program_spin) == 0);
+  ubasic_set_variable(&infos[0], 0, 0);
+  ubasic_init(&infos[1], program_park);
+  infos[1].poke_function = park_poke;
+  infos[1].app_context = &scheduler;
+  assert(ubasic_scheduler_add(&scheduler, &infos[0]) == 0);
+  assert(ubasic_scheduler_add(&scheduler, &infos[1]) == 1);
+  assert(ubasic_scheduler_run(&scheduler) == 1);
+  assert(ubasic_finished(&infos[1]));
+  assert(!ubasic_finished(&infos[0]));
+  assert(scheduler.tasks[0].state == UBASIC_TASK_PARKED);
+
+  ubasic_set_variable(&infos[0], 0, VARIABLE_FROM_INT(1));
+  ubasic_scheduler_wake(&scheduler, 0);
+  assert(ubasic_scheduler_run(&scheduler) == 0);
+  assert(ubasic_finished(&infos[0]));
+  assert(ubasic_error(&infos[0]) == UBASIC_ERROR_NONE);
+  ubasic_free(&infos[0]);
+  ubasic_free(&infos[1]);
+  ubasic_scheduler_free(&scheduler);
+
+  /* Suspended scripts are parked until their values arrive. */
+  assert(ubasic_scheduler_init(&scheduler, SUSPEND_TASKS,
+                               SCHEDULER_WORKERS, NULL) == 0);
+  for(i = 0; i < SUSPEND_TASKS; i++) {
+    assert(ubasic_compile(&infos[i], program_suspend) == 0);
+    requests[i].info = &infos[i];
+    requests[i].pending = 0;
+    infos[i].app_context = &requests[i];
+    infos[i].input_function = suspend_input;
+    infos[i].peek_function = suspend_input;
+    assert(ubasic_scheduler_add(&scheduler, &infos[i]) == i);
+  }
+  rounds = 0;
+  while(ubasic_scheduler_run(&scheduler) > 0) {
+    for(i = 0; i < SUSPEND_TASKS; i++) {
+      assert(requests[i].pending);
+      requests[i].pending = 0;
+      ubasic_scheduler_resume(&scheduler, i,
+                              requests[i].addr * (i + 1));
+    }
+    rounds++;
+  }
+  assert(rounds == 3);
+  for(i = 0; i < SUSPEND_TASKS; i++) {
+    assert(ubasic_finished(&infos[i]));
+    assert(ubasic_get_variable(&infos[i], 3) ==
+           VARIABLE_FROM_INT(3 * (i + 1)));
+    ubasic_free(&infos[i]);
+  }
+  ubasic_scheduler_free(&scheduler);
+
+  printf("done.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+void run_batch(void) {
+  VARIABLE_TYPE inputs[3 * UBASIC_BATCH_VARIABLES] = { 0 };
+  VARIABLE_TYPE outputs[3 * UBASIC_BATCH_VARIABLES];
+  struct ubasic_program *program;
+  ubasic_info other;
+  int i;
+
+  printf("Running batch... ");
+  fflush(stdout);
+
+  for(i = 0; i < 3; i++) {
+    inputs[i * UBASIC_BATCH_VARIABLES + 0] = VARIABLE_FROM_INT(i);
+    inputs[i * UBASIC_BATCH_VARIABLES + 1] = VARIABLE_FROM_INT(10);
+    inputs[i * UBASIC_BATCH_VARIABLES + 2] = VARIABLE_FROM_INT(100 * i);
+  }
+
+  /* One compiled program, shared by two interpreters. */
+  program = ubasic_compiler_compile(program_batch);
+  assert(program != NULL);
+  ubasic_init_program(&info, program);
+  ubasic_init_program(&other, program);
+
+  ubasic_exec_batch(&info, inputs, 3, outputs);
+  for(i = 0; i < 3; i++) {
+    assert(outputs[i * UBASIC_BATCH_VARIABLES + 2] ==
+           VARIABLE_FROM_INT(i * 10 + 100 * i + 6));
+    assert(outputs[i * UBASIC_BATCH_VARIABLES + 8] == VARIABLE_FROM_INT(4));
+    /* Long names are not part of a record and start at 0 each time. */
+    assert(outputs[i * UBASIC_BATCH_VARIABLES + 17] == VARIABLE_FROM_INT(1));
+  }
+
+  ubasic_exec_batch(&other, inputs + 2 * UBASIC_BATCH_VARIABLES, 1, outputs);
+  assert(outputs[2] == VARIABLE_FROM_INT(20 + 200 + 6));
+
+  ubasic_free(&info);
+  ubasic_free(&other);
+  ubasic_compiler_free(program);
+
+  printf("done.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+void run_expressions(void) {
+  struct ubasic_program *program;
+  const struct ubasic_expr *exprs;
+
+  printf("Running expressions... ");
+  fflush(stdout);
+
+  program = ubasic_compiler_compile(program_exprs);
+  assert(program != NULL);
+  exprs = program->exprs;
+  assert(program->num_exprs == 7);
+  assert(exprs[0].kind == UBASIC_EXPR_CONST);
+  assert(exprs[0].value == VARIABLE_FROM_INT(123));
+  assert(exprs[1].kind == UBASIC_EXPR_POSTFIX);
+  assert(exprs[2].kind == UBASIC_EXPR_VAR_EQ_CONST);
+  assert(exprs[3].kind == UBASIC_EXPR_VAR_MUL_VAR);
+  assert(exprs[4].kind == UBASIC_EXPR_VAR_GT_CONST);
+  assert(exprs[5].kind == UBASIC_EXPR_CONST);
+  assert(exprs[6].kind == UBASIC_EXPR_POSTFIX);
+  ubasic_compiler_free(program);
+
+  printf("done.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+void run_stacks(void) {
+  int compiled;
+
+  printf("Running stacks... ");
+  fflush(stdout);
+
+  for(compiled = 0; compiled < 2; compiled++) {
+    if(compiled) {
+      assert(ubasic_compile(&info, program_recursion) == 0);
+    } else {
+      ubasic_init(&info, program_recursion);
+    }
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_GOSUB_STACK_OVERFLOW);
+    assert(ubasic_get_variable(&info, 3) ==
+           VARIABLE_FROM_INT(MAX_GOSUB_STACK_DEPTH));
+    ubasic_free(&info);
+
+    if(compiled) {
+      assert(ubasic_compile(&info, program_recursion) == 0);
+    } else {
+      ubasic_init(&info, program_recursion);
+    }
+    assert(ubasic_set_stack_depths(&info, 50, 0) == 0);
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_NONE);
+    assert(ubasic_get_variable(&info, 3) == VARIABLE_FROM_INT(50));
+    ubasic_free(&info);
+
+    if(compiled) {
+      assert(ubasic_compile(&info, program_nested_for) == 0);
+    } else {
+      ubasic_init(&info, program_nested_for);
+    }
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_FOR_STACK_OVERFLOW);
+    ubasic_free(&info);
+
+    if(compiled) {
+      assert(ubasic_compile(&info, program_nested_for) == 0);
+    } else {
+      ubasic_init(&info, program_nested_for);
+    }
+    assert(ubasic_set_stack_depths(&info, 0, 5) == 0);
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_NONE);
+    assert(ubasic_get_variable(&info, 5) == VARIABLE_FROM_INT(32));
+    ubasic_free(&info);
+  }
+
+  printf("done.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE memory[256];
+static int memory_calls;
+
+VARIABLE_TYPE memory_peek(VARIABLE_TYPE addr, void *context) {
+  memory_calls++;
+  return memory[VARIABLE_TO_INT(addr)];
+}
+
+void memory_poke(VARIABLE_TYPE addr, VARIABLE_TYPE value, void *context) {
+  memory_calls++;
+  memory[VARIABLE_TO_INT(addr)] = value;
+}
+
+void memory_peek_block(VARIABLE_TYPE addr, VARIABLE_TYPE *values, int count,
+                       void *context) {
+  memory_calls++;
+  assert(VARIABLE_TO_INT(addr) + count <= 256);
+  memcpy(values, memory + VARIABLE_TO_INT(addr), count * sizeof(*values));
+}
+
+void memory_poke_block(VARIABLE_TYPE addr, const VARIABLE_TYPE *values,
+                       int count, void *context) {
+  memory_calls++;
+  assert(VARIABLE_TO_INT(addr) + count <= 256);
+  memcpy(memory + VARIABLE_TO_INT(addr), values, count * sizeof(*values));
+}
+
+/*---------------------------------------------------------------------------*/
+void run_block(void) {
+  int compiled, block;
+
+  printf("Running block peek and poke... ");
+  fflush(stdout);
+
+  for(compiled = 0; compiled < 2; compiled++) {
+    for(block = 0; block < 2; block++) {
+      if(compiled) {
+        assert(ubasic_compile(&info, program_block) == 0);
+      } else {
+        ubasic_init(&info, program_block);
+      }
+      info.peek_function = memory_peek;
+      info.poke_function = memory_poke;
+      if(block) {
+        info.peek_block_function = memory_peek_block;
+        info.poke_block_function = memory_poke_block;
+      }
+      memset(memory, 0, sizeof(memory));
+      memory_calls = 0;
+      while(ubasic_run_until(&info, 1000) == 1000);
+      assert(ubasic_error(&info) == UBASIC_ERROR_NONE);
+      assert(memory[99] == 0 && memory[100] == VARIABLE_FROM_INT(7));
+      assert(memory[139] == VARIABLE_FROM_INT(7) && memory[140] == 0);
+      assert(ubasic_get_variable(&info, 1) == 0);
+      assert(ubasic_get_variable(&info, 2) == VARIABLE_FROM_INT(7));
+      assert(ubasic_get_variable(&info, 3) == VARIABLE_FROM_INT(7));
+      assert(ubasic_get_variable(&info, 21) == VARIABLE_FROM_INT(7));
+      assert(ubasic_get_variable(&info, 22) == 0);
+      assert(ubasic_get_variable(&info, 23) == VARIABLE_FROM_INT(7));
+      assert(ubasic_get_variable(&info, 24) == VARIABLE_FROM_INT(3));
+      assert(ubasic_get_variable(&info, 25) == 0);
+      /* The 40 value fill goes in two pieces. */
+      assert(memory_calls == (block ? 6 : 40 + 3 + 2 + 4 + 1));
+      ubasic_free(&info);
+    }
+
+    if(compiled) {
+      assert(ubasic_compile(&info, program_block_range) == 0);
+    } else {
+      ubasic_init(&info, program_block_range);
+    }
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_OUT_OF_RANGE);
+    assert(info.error_line_number == 20);
+    ubasic_free(&info);
+
+    /* Blocks do not reach the slots of long names. */
+    if(compiled) {
+      assert(ubasic_compile(&info, program_block_name) == 0);
+    } else {
+      ubasic_init(&info, program_block_name);
+    }
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_OUT_OF_RANGE);
+    assert(info.error_line_number == 20);
+    ubasic_free(&info);
+
+#if UBASIC_VARTYPE == UBASIC_VARTYPE_INT64
+    /* A count that does not fit in an int is not cut down to one. */
+    if(compiled) {
+      assert(ubasic_compile(&info, program_block_count) == 0);
+    } else {
+      ubasic_init(&info, program_block_count);
+    }
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_OUT_OF_RANGE);
+    assert(info.error_line_number == 10);
+    ubasic_free(&info);
+#endif
+  }
+
+  printf("done.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+void run_arrays(void) {
+  const struct ubasic_program *program;
+  int compiled, unchecked, pc, i;
+
+  printf("Running arrays... ");
+  fflush(stdout);
+
+  for(compiled = 0; compiled < 2; compiled++) {
+    if(compiled) {
+      assert(ubasic_compile(&info, program_arrays) == 0);
+    } else {
+      ubasic_init(&info, program_arrays);
+    }
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_NONE);
+    assert(ubasic_get_variable(&info, 18) == VARIABLE_FROM_INT(285));
+    assert(ubasic_get_variable(&info, 19) == VARIABLE_FROM_INT(33 + 25));
+
+    if(compiled) {
+      /* All but a(s % 10) and b(i, j), whose i loop has another loop
+         inside, go without bounds checks. */
+      program = info.program;
+      assert(program->array_cells == 10 + 3 * 4);
+      unchecked = 0;
+      for(pc = 0; pc < program->code_len; pc++) {
+        if(program->code[pc].token == TOKENIZER_LEFTPAREN &&
+           program->code[pc].arg == 1) {
+          unchecked++;
+        }
+      }
+      assert(unchecked == 1);
+      unchecked = 0;
+      for(i = 0; i < program->num_ops; i++) {
+        if(program->ops[i].op == UBASIC_OP_ELEMENT_UNCHECKED ||
+           program->ops[i].op == UBASIC_OP_ELEMENT2_UNCHECKED) {
+          unchecked++;
+        } else {
+          assert(program->ops[i].op != UBASIC_OP_ELEMENT2);
+        }
+      }
+      assert(unchecked == 2);
+    }
+    ubasic_free(&info);
+
+    if(compiled) {
+      assert(ubasic_compile(&info, program_array_range) == 0);
+    } else {
+      ubasic_init(&info, program_array_range);
+    }
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_OUT_OF_RANGE);
+    assert(info.error_line_number == 30);
+    ubasic_free(&info);
+
+    if(compiled) {
+      assert(ubasic_compile(&info, program_array_missing) == 0);
+    } else {
+      ubasic_init(&info, program_array_missing);
+    }
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_OUT_OF_RANGE);
+    assert(info.error_line_number == 10);
+    ubasic_free(&info);
+
+    if(compiled) {
+      assert(ubasic_compile(&info, program_array_early) == 0);
+      assert(info.program->arrays[0].size1 == 10);
+      assert(info.program->arrays[12].size1 == 3);
+      assert(info.program->arrays[12].size2 == 4);
+    } else {
+      ubasic_init(&info, program_array_early);
+    }
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_OUT_OF_RANGE);
+    assert(info.error_line_number == 50);
+    ubasic_free(&info);
+
+    if(compiled) {
+      assert(ubasic_compile(&info, program_array_loop_into) == 0);
+    } else {
+      ubasic_init(&info, program_array_loop_into);
+    }
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_OUT_OF_RANGE);
+    assert(info.error_line_number == 25);
+    ubasic_free(&info);
+
+    if(compiled) {
+      assert(ubasic_compile(&info, program_array_early_let) == 0);
+    } else {
+      ubasic_init(&info, program_array_early_let);
+    }
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_OUT_OF_RANGE);
+    assert(info.error_line_number == 10);
+    ubasic_free(&info);
+
+    if(compiled) {
+      assert(ubasic_compile(&info, program_array_memory) == 0);
+    } else {
+      ubasic_init(&info, program_array_memory);
+    }
+    assert(ubasic_set_array_size(&info, 4) == 0);
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_OUT_OF_MEMORY);
+    assert(info.error_line_number == 20);
+    ubasic_free(&info);
+  }
+
+  printf("done.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+void run_names(void) {
+  int compiled, luck;
+
+  printf("Running names... ");
+  fflush(stdout);
+
+  for(compiled = 0; compiled < 2; compiled++) {
+    if(compiled) {
+      assert(ubasic_compile(&info, program_names) == 0);
+    } else {
+      ubasic_init(&info, program_names);
+    }
+    /* Slots are known before the program runs. */
+    assert(ubasic_variable_slot(&info, "a") == 0);
+    assert(ubasic_variable_slot(&info, "z") == 25);
+    assert(ubasic_variable_slot(&info, "sum") == 26);
+    assert(ubasic_variable_slot(&info, "count") == 27);
+    assert(ubasic_variable_slot(&info, "rest") == 28);
+    assert(ubasic_variable_slot(&info, "su") == -1);
+    luck = ubasic_variable_slot(&info, "luck");
+    assert(luck == 30);
+    ubasic_set_variable(&info, 0, VARIABLE_FROM_INT(1));
+
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_NONE);
+    assert(ubasic_get_variable(&info, 26) == VARIABLE_FROM_INT(55));
+    assert(ubasic_get_variable(&info, 28) == VARIABLE_FROM_INT(50));
+    assert(ubasic_get_variable(&info, luck) == VARIABLE_FROM_INT(51));
+
+    /* Slots outside the variables are ignored. */
+    ubasic_set_variable(&info, MAX_VARNUM, VARIABLE_FROM_INT(1));
+    ubasic_set_variable(&info, -1, VARIABLE_FROM_INT(1));
+    assert(ubasic_get_variable(&info, MAX_VARNUM) == 0);
+    assert(ubasic_get_variable(&info, -1) == 0);
+    assert(ubasic_variable_slot(&info, "sum") == 26);
+    ubasic_free(&info);
+
+    if(compiled) {
+      assert(ubasic_compile(&info, program_keywords) == 0);
+    } else {
+      ubasic_init(&info, program_keywords);
+    }
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_NONE);
+    assert(ubasic_get_variable(&info, ubasic_variable_slot(&info, "count")) ==
+           VARIABLE_FROM_INT(6));
+    ubasic_free(&info);
+
+    /* total is to followed by tal. */
+    if(compiled) {
+      assert(ubasic_compile(&info, program_keyword_name) == 0);
+    } else {
+      ubasic_init(&info, program_keyword_name);
+    }
+    assert(ubasic_variable_slot(&info, "total") == -1);
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_error(&info) == UBASIC_ERROR_SYNTAX);
+    assert(info.error_line_number == 10);
+    ubasic_free(&info);
+  }
+
+  printf("done.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+struct output_capture {
+  char text[64];
+  size_t len;
+  int writes;
+};
+
+void write_capture(const char *data, size_t len, void *context) {
+  struct output_capture *capture = context;
+
+  assert(capture->len + len < sizeof(capture->text));
+  memcpy(capture->text + capture->len, data, len);
+  capture->len += len;
+  capture->text[capture->len] = '\0';
+  capture->writes++;
+}
+
+/*---------------------------------------------------------------------------*/
+void run_output(void) {
+  static const size_t sizes[] = { UBASIC_OUTPUT_SIZE, 8, 0 };
+  struct output_capture capture;
+  int compiled;
+  size_t i;
+
+  printf("Running output... ");
+  fflush(stdout);
+
+  for(compiled = 0; compiled < 2; compiled++) {
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      if(compiled) {
+        assert(ubasic_compile(&info, program_print) == 0);
+      } else {
+        ubasic_init(&info, program_print);
+      }
+      memset(&capture, 0, sizeof(capture));
+      info.output.write = write_capture;
+      info.output.context = &capture;
+      assert(ubasic_set_output_size(&info, sizes[i]) == 0);
+      while(ubasic_run_until(&info, 1000) == 1000);
+      assert(strcmp(capture.text, "i 1-25\n1000\n2000\n3000\n") == 0);
+      /* Everything in one go at END, unless the buffer is too small. */
+      assert(sizes[i] < capture.len ? capture.writes > 1 :
+             capture.writes == 1);
+      ubasic_free(&info);
+    }
+  }
+
+  /* Without a write function output goes to a FILE, or to a file
+     descriptor where one is set. */
+  for(i = 0; i < 2; i++) {
+    char text[64];
+    FILE *file;
+    int fds[2];
+    ssize_t len;
+
+    ubasic_init(&info, program_print);
+    if(i == 0) {
+      file = tmpfile();
+      assert(file != NULL);
+      info.output.file = file;
+    } else {
+      assert(pipe(fds) == 0);
+      info.output.fd = fds[1];
+    }
+    while(ubasic_run_until(&info, 1000) == 1000);
+    ubasic_free(&info);
+    if(i == 0) {
+      rewind(file);
+      len = fread(text, 1, sizeof(text) - 1, file);
+      fclose(file);
+    } else {
+      close(fds[1]);
+      len = read(fds[0], text, sizeof(text) - 1);
+      close(fds[0]);
+    }
+    assert(len >= 0);
+    text[len] = 0;
+    assert(strcmp(text, "i 1-25\n1000\n2000\n3000\n") == 0);
+  }
+
+  printf("done.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+void run_arena(void) {
+  static char buffer[4096];
+  struct ubasic_arena arena;
+  struct ubasic_allocator allocator;
+  int i;
+
+  printf("Running arena... ");
+  fflush(stdout);
+
+  ubasic_arena_init(&arena, buffer, sizeof(buffer));
+  ubasic_arena_allocator(&arena, &allocator);
+  for(i = 0; i < 10; i++) {
+    ubasic_arena_reset(&arena);
+    if(i % 2 == 0) {
+      ubasic_init_with(&info, program_gosub_if, &allocator);
+    } else {
+      assert(ubasic_compile_with(&info, program_gosub_if, &allocator) == 0);
+    }
+    assert(arena.used > 0);
+    while(ubasic_run_until(&info, 1000) == 1000);
+    assert(ubasic_get_variable(&info, 18) == VARIABLE_FROM_INT(40));
+    ubasic_free(&info);
+  }
+
+  /* Too small to compile into. */
+  ubasic_arena_init(&arena, buffer, 64);
+  assert(ubasic_compile_with(&info, program_let, &allocator) == -1);
+  ubasic_free(&info);
+
+  printf("done.\n");
+}
+
+/*---------------------------------------------------------------------------*/
+#if UBASIC_PROFILE
+void run_profile(void) {
+  struct ubasic_profile *profile;
+  int i;
+
+  printf("Running profile... ");
+  fflush(stdout);
+
+  assert(ubasic_compile(&info, program_gosub_if) == 0);
+  assert(ubasic_profile_start(&info) == 0);
+  while(ubasic_run_until(&info, 1000) == 1000);
+
+  profile = info.profile;
+  for(i = 0; i < profile->num_lines; i++) {
+    switch(profile->lines[i].line_number) {
+    case 10:
+    case 20:
+    case 50:
+      assert(profile->lines[i].count == 1);
+      break;
+    case 30:
+    case 40:
+    case 100:
+    case 110:
+      assert(profile->lines[i].count == 10);
+      break;
+    }
+  }
+  ubasic_profile_dump(profile, stdout);
+  ubasic_profile_dump_collapsed(profile, stdout);
+  ubasic_free(&info);
+
+  printf("done.\n");
+}
+#endif /* UBASIC_PROFILE */
+
 /*---------------------------------------------------------------------------*/
 int
 main(void)
 {
-  run(program_let);
-  assert(ubasic_get_variable(0) == 42);
+  int mode;
+
+  for(mode = 0; mode < NUM_MODES; mode++) {
+    run(program_let, mode);
+    assert(ubasic_get_variable(&info, 0) == VARIABLE_FROM_INT(42));
+    ubasic_free(&info);
+
+    run(program_goto, mode);
+    assert(ubasic_get_variable(&info, 2) == VARIABLE_FROM_INT(108));
+    ubasic_free(&info);
+
+    run(program_goto_missing, mode);
+    assert(ubasic_get_variable(&info, 0) == VARIABLE_FROM_INT(7));
+    ubasic_free(&info);
+
+    run(program_loop, mode);
+#if UBASIC_OVERFLOW_TRAP && (UBASIC_VARTYPE == UBASIC_VARTYPE_INT16 || \
+                             UBASIC_VARTYPE == UBASIC_VARTYPE_FIXED)
+    assert(ubasic_error(&info) == UBASIC_ERROR_OVERFLOW);
+#else
+    assert(ubasic_error(&info) == UBASIC_ERROR_NONE);
+    assert(ubasic_get_variable(&info, 0) == VARIABLE_FROM_INT(126 * 126 * 10));
+#endif
+    ubasic_free(&info);
+
+    run(program_fibs, mode);
+    assert(ubasic_get_variable(&info, 1) == VARIABLE_FROM_INT(89));
+    ubasic_free(&info);
+
+    run(program_gosub_if, mode);
+    assert(ubasic_get_variable(&info, 18) == VARIABLE_FROM_INT(40));
+    ubasic_free(&info);
+
+    run(program_if_else, mode);
+    assert(ubasic_get_variable(&info, 0) == VARIABLE_FROM_INT(2));
+    assert(ubasic_get_variable(&info, 1) == VARIABLE_FROM_INT(2));
+    assert(ubasic_get_variable(&info, 2) == VARIABLE_FROM_INT(44));
+    ubasic_free(&info);
+
+    run(program_peek_poke, mode);
+    assert(ubasic_get_variable(&info, 0) == VARIABLE_FROM_INT(123));
+    assert(ubasic_get_variable(&info, 25) == VARIABLE_FROM_INT(123));
+    ubasic_free(&info);
+
+    run(program_exprs, mode);
+    assert(ubasic_get_variable(&info, 1) == VARIABLE_FROM_INT(6));
+    assert(ubasic_get_variable(&info, 2) == VARIABLE_FROM_INT(123 * 123));
+    assert(ubasic_get_variable(&info, 3) == VARIABLE_FROM_INT(1));
+    assert(ubasic_get_variable(&info, 4) == VARIABLE_FROM_INT(118));
+    ubasic_free(&info);
+
+    run(program_divide_by_zero, mode);
+    assert(ubasic_error(&info) == UBASIC_ERROR_DIVISION_BY_ZERO);
+    assert(info.error_line_number == 20);
+    assert(ubasic_get_variable(&info, 0) == VARIABLE_FROM_INT(1));
+    ubasic_free(&info);
 
-  run(program_goto);
-  assert(ubasic_get_variable(2) == 108);
+    run(program_syntax_error, mode);
+    assert(ubasic_error(&info) == UBASIC_ERROR_SYNTAX);
+    assert(info.error_line_number == 20);
+    assert(info.error_column == 12);
+    assert(ubasic_get_variable(&info, 0) == VARIABLE_FROM_INT(1));
+    ubasic_free(&info);
 
-  run(program_loop);
-  assert(ubasic_get_variable(0) == (VARIABLE_TYPE)(126 * 126 * 10));
+    run(program_bad_statement, mode);
+    assert(ubasic_error(&info) == UBASIC_ERROR_SYNTAX);
+    assert(info.error_line_number == 20);
+    assert(info.error_column == 4);
+    assert(ubasic_get_variable(&info, 0) == VARIABLE_FROM_INT(3));
+    ubasic_free(&info);
 
-  run(program_fibs);
-  assert(ubasic_get_variable(1) == 89);
+#if UBASIC_VARTYPE == UBASIC_VARTYPE_FIXED
+    run(program_arith, mode);
+    assert(ubasic_get_variable(&info, 0) == VARIABLE_FROM_INT(7) / 2);
+    assert(ubasic_get_variable(&info, 1) == VARIABLE_FROM_INT(1) / 4);
+    ubasic_free(&info);
+#elif UBASIC_VARTYPE != UBASIC_VARTYPE_INT16
+    run(program_arith, mode);
+    assert(ubasic_get_variable(&info, 0) == 1996002);
+    assert(ubasic_get_variable(&info, 1) == -1330668);
+    ubasic_free(&info);
+#endif
+  }
 
-  run(program_peek_poke);
-  assert(ubasic_get_variable(0) == 123);
-  assert(ubasic_get_variable(25) == 123);
+  run_expressions();
+  run_batch();
+  run_stacks();
+  run_block();
+  run_suspend();
+  run_snapshot();
+  run_image();
+  run_arrays();
+  run_names();
+  run_output();
+  run_arena();
+#if UBASIC_PROFILE
+  run_profile();
+#endif
+  run_threads();
+  run_scheduler();
 
   return 0;
 }
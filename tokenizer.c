@@ -41,42 +41,33 @@
 #include <ctype.h>
 #include <stdlib.h>
 
-//static char const *ptr, *nextptr;
-
 #define MAX_NUMLEN 6
 
-struct keyword_token {
-  char *keyword;
-  int token;
+/* Single character tokens, indexed by character. Everything else is 0,
+   which is TOKENIZER_ERROR. */
+static const unsigned char singlechar_tokens[256] = {
+  ['\n'] = TOKENIZER_CR,
+  [','] = TOKENIZER_COMMA,
+  [';'] = TOKENIZER_SEMICOLON,
+  ['+'] = TOKENIZER_PLUS,
+  ['-'] = TOKENIZER_MINUS,
+  ['&'] = TOKENIZER_AND,
+  ['|'] = TOKENIZER_OR,
+  ['*'] = TOKENIZER_ASTR,
+  ['/'] = TOKENIZER_SLASH,
+  ['%'] = TOKENIZER_MOD,
+  ['('] = TOKENIZER_LEFTPAREN,
+  ['#'] = TOKENIZER_HASH,
+  [')'] = TOKENIZER_RIGHTPAREN,
+  ['<'] = TOKENIZER_LT,
+  ['>'] = TOKENIZER_GT,
+  ['='] = TOKENIZER_EQ,
 };
 
-static int current_token = TOKENIZER_ERROR;
-
-static const struct keyword_token keywords[] = {
-  {"let", TOKENIZER_LET},
-  {"print", TOKENIZER_PRINT},
-  {"if", TOKENIZER_IF},
-  {"then", TOKENIZER_THEN},
-  {"else", TOKENIZER_ELSE},
-  {"for", TOKENIZER_FOR},
-  {"to", TOKENIZER_TO},
-  {"next", TOKENIZER_NEXT},
-  {"goto", TOKENIZER_GOTO},
-  {"gosub", TOKENIZER_GOSUB},
-  {"return", TOKENIZER_RETURN},
-  {"call", TOKENIZER_CALL},
-  {"rem", TOKENIZER_REM},
-  {"input", TOKENIZER_INPUT},
-  {"user", TOKENIZER_USER},
-  {"peek", TOKENIZER_PEEK},
-  {"poke", TOKENIZER_POKE},
-  {"end", TOKENIZER_END},
-  {NULL, TOKENIZER_ERROR}
-};
-
-
 /*---------------------------------------------------------------------------*/
 static int singlechar(ubasic_tokenizer_info *info);
+static int name_char(char c);
+static int keyword(const char *ptr, char const **nextptr);
 static int get_next_token(ubasic_tokenizer_info *info);
 void ubasic_tokenizer_error_print(ubasic_tokenizer_info *info);
 int ubasic_tokenizer_finished(ubasic_tokenizer_info *info);
@@ -88,46 +79,85 @@ char const *ubasic_tokenizer_pos(ubasic_tokenizer_info *info);
 static int
 singlechar(ubasic_tokenizer_info *info)
 {
-  if(*info->ptr == '\n') {
-    return TOKENIZER_CR;
-  } else if(*info->ptr == ',') {
-    return TOKENIZER_COMMA;
-  } else if(*info->ptr == ';') {
-    return TOKENIZER_SEMICOLON;
-  } else if(*info->ptr == '+') {
-    return TOKENIZER_PLUS;
-  } else if(*info->ptr == '-') {
-    return TOKENIZER_MINUS;
-  } else if(*info->ptr == '&') {
-    return TOKENIZER_AND;
-  } else if(*info->ptr == '|') {
-    return TOKENIZER_OR;
-  } else if(*info->ptr == '*') {
-    return TOKENIZER_ASTR;
-  } else if(*info->ptr == '/') {
-    return TOKENIZER_SLASH;
-  } else if(*info->ptr == '%') {
-    return TOKENIZER_MOD;
-  } else if(*info->ptr == '(') {
-    return TOKENIZER_LEFTPAREN;
-  } else if(*info->ptr == '#') {
-    return TOKENIZER_HASH;
-  } else if(*info->ptr == ')') {
-    return TOKENIZER_RIGHTPAREN;
-  } else if(*info->ptr == '<') {
-    return TOKENIZER_LT;
-  } else if(*info->ptr == '>') {
-    return TOKENIZER_GT;
-  } else if(*info->ptr == '=') {
-    return TOKENIZER_EQ;
+  return singlechar_tokens[(unsigned char)*info->ptr];
+}
+/*---------------------------------------------------------------------------*/
+static int
+name_char(char c)
+{
+  return (c >= 'a' && c <= 'z') || isdigit((unsigned char)c) || c == '_';
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Keywords are told apart by their first character, so that each one is
+ * compared against at most three candidates. A keyword is found wherever
+ * it starts, even if more letters follow, so that "goto100" and
+ * "fori=1to9" read as they always have.
+ */
+#define KEYWORD(word, token)                                    \
+  if(strncmp(ptr, word, sizeof(word) - 1) == 0) {               \
+    *nextptr = ptr + sizeof(word) - 1;                          \
+    return token;                                               \
+  }
+
+static int
+keyword(const char *ptr, char const **nextptr)
+{
+  switch(*ptr) {
+  case 'c':
+    KEYWORD("call", TOKENIZER_CALL);
+    break;
+  case 'd':
+    KEYWORD("dim", TOKENIZER_DIM);
+    break;
+  case 'e':
+    KEYWORD("else", TOKENIZER_ELSE);
+    KEYWORD("end", TOKENIZER_END);
+    break;
+  case 'f':
+    KEYWORD("for", TOKENIZER_FOR);
+    break;
+  case 'g':
+    KEYWORD("goto", TOKENIZER_GOTO);
+    KEYWORD("gosub", TOKENIZER_GOSUB);
+    break;
+  case 'i':
+    KEYWORD("if", TOKENIZER_IF);
+    KEYWORD("input", TOKENIZER_INPUT);
+    break;
+  case 'l':
+    KEYWORD("let", TOKENIZER_LET);
+    break;
+  case 'n':
+    KEYWORD("next", TOKENIZER_NEXT);
+    break;
+  case 'p':
+    KEYWORD("print", TOKENIZER_PRINT);
+    KEYWORD("peek", TOKENIZER_PEEK);
+    KEYWORD("poke", TOKENIZER_POKE);
+    break;
+  case 'r':
+    KEYWORD("return", TOKENIZER_RETURN);
+    KEYWORD("rem", TOKENIZER_REM);
+    break;
+  case 't':
+    KEYWORD("then", TOKENIZER_THEN);
+    KEYWORD("to", TOKENIZER_TO);
+    break;
+  case 'u':
+    KEYWORD("user", TOKENIZER_USER);
+    break;
   }
-  return 0;
+  return TOKENIZER_ERROR;
 }
+
+#undef KEYWORD
 /*---------------------------------------------------------------------------*/
 static int
 get_next_token(ubasic_tokenizer_info *info)
 {
-  struct keyword_token const *kt;
+  char const *end;
+  int token;
   int i;
 
   DEBUG_PRINTF("get_next_token(): '%s'\n", info->ptr);
@@ -154,9 +184,9 @@ get_next_token(ubasic_tokenizer_info *info)
     }
     DEBUG_PRINTF("get_next_token: error due to too long number\n");
     return TOKENIZER_ERROR;
-  } else if(singlechar(info)) {
-	  info->nextptr = info->ptr + 1;
-    return singlechar(info);
+  } else if((token = singlechar(info)) != TOKENIZER_ERROR) {
+    info->nextptr = info->ptr + 1;
+    return token;
   } else if(*info->ptr == '"') {
 	  info->nextptr = info->ptr;
     do {
@@ -164,17 +194,19 @@ get_next_token(ubasic_tokenizer_info *info)
     } while(*info->nextptr != '"');
     ++info->nextptr;
     return TOKENIZER_STRING;
-  } else {
-    for(kt = keywords; kt->keyword != NULL; ++kt) {
-      if(strncmp(info->ptr, kt->keyword, strlen(kt->keyword)) == 0) {
-    	  info->nextptr = info->ptr + strlen(kt->keyword);
-        return kt->token;
-      }
-    }
+  } else if((token = keyword(info->ptr, &info->nextptr)) !=
+            TOKENIZER_ERROR) {
+    return token;
   }
 
+  /* A name ends where a keyword starts, so that keywords written right
+     after a variable are still found. */
   if(*info->ptr >= 'a' && *info->ptr <= 'z') {
 	  info->nextptr = info->ptr + 1;
+    while(name_char(*info->nextptr) &&
+          keyword(info->nextptr, &end) == TOKENIZER_ERROR) {
+      ++info->nextptr;
+    }
     return TOKENIZER_VARIABLE;
   }
 
@@ -185,22 +217,22 @@ get_next_token(ubasic_tokenizer_info *info)
 void
 ubasic_tokenizer_goto(ubasic_tokenizer_info *info, const char *program)
 {
-	info->ptr = program;
-  current_token = get_next_token(info);
+  info->ptr = program;
+  info->current_token = get_next_token(info);
 }
 /*---------------------------------------------------------------------------*/
 void
 ubasic_tokenizer_init(ubasic_tokenizer_info *info, const char *program)
 {
-	info->current_token = TOKENIZER_ERROR;
+  info->current_token = TOKENIZER_ERROR;
+  info->symbols = NULL;
   ubasic_tokenizer_goto(info, program);
-  current_token = get_next_token(info);
 }
 /*---------------------------------------------------------------------------*/
 int
 ubasic_tokenizer_token(ubasic_tokenizer_info *info)
 {
-  return current_token;
+  return info->current_token;
 }
 /*---------------------------------------------------------------------------*/
 void
@@ -211,15 +243,15 @@ ubasic_tokenizer_next(ubasic_tokenizer_info *info)
     return;
   }
 
-  DEBUG_PRINTF("tokenizer_next: %p\n", nextptr);
+  DEBUG_PRINTF("tokenizer_next: %p\n", info->nextptr);
   info->ptr = info->nextptr;
 
   while(*info->ptr == ' ') {
     ++info->ptr;
   }
-  current_token = get_next_token(info);
+  info->current_token = get_next_token(info);
 
-  if(current_token == TOKENIZER_REM) {
+  if(info->current_token == TOKENIZER_REM) {
       while(!(*info->nextptr == '\n' || ubasic_tokenizer_finished(info))) {
         ++info->nextptr;
       }
@@ -229,7 +261,7 @@ ubasic_tokenizer_next(ubasic_tokenizer_info *info)
       ubasic_tokenizer_next(info);
   }
 
-  DEBUG_PRINTF("tokenizer_next: '%s' %d\n", info->ptr, current_token);
+  DEBUG_PRINTF("tokenizer_next: '%s' %d\n", info->ptr, info->current_token);
   return;
 }
 /*---------------------------------------------------------------------------*/
@@ -253,8 +285,8 @@ ubasic_tokenizer_string(ubasic_tokenizer_info *info, char *dest, int len)
     return;
   }
   string_len = string_end - info->ptr - 1;
-  if(len < string_len) {
-    string_len = len;
+  if(len <= string_len) {
+    string_len = len - 1;
   }
   memcpy(dest, info->ptr + 1, string_len);
   dest[string_len] = 0;
@@ -269,13 +301,21 @@ ubasic_tokenizer_error_print(ubasic_tokenizer_info *info)
 int
 ubasic_tokenizer_finished(ubasic_tokenizer_info *info)
 {
-  return *info->ptr == 0 || current_token == TOKENIZER_ENDOFINPUT;
+  return *info->ptr == 0 || info->current_token == TOKENIZER_ENDOFINPUT;
 }
 /*---------------------------------------------------------------------------*/
+/*
+ * Returns the slot of the current variable, or -1 if it has a long name
+ * that is not in the tokenizer's symbol table.
+ */
 int
 ubasic_tokenizer_variable_num(ubasic_tokenizer_info *info)
 {
-  return *info->ptr - 'a';
+  if(info->nextptr == info->ptr + 1) {
+    return *info->ptr - 'a';
+  }
+  return ubasic_symbols_find(info->symbols, info->ptr,
+                             info->nextptr - info->ptr);
 }
 /*---------------------------------------------------------------------------*/
 char const *
@@ -283,3 +323,48 @@ ubasic_tokenizer_pos(ubasic_tokenizer_info *info)
 {
     return info->ptr;
 }
+/*---------------------------------------------------------------------------*/
+/*
+ * Returns the slot of the variable with the name of len characters, or -1
+ * if there is none. symbols may be NULL for a program without long names.
+ */
+int
+ubasic_symbols_find(const struct ubasic_symbols *symbols,
+                    const char *name, int len)
+{
+  int i;
+
+  if(len == 1 && *name >= 'a' && *name <= 'z') {
+    return *name - 'a';
+  }
+  if(symbols == NULL || len > UBASIC_MAX_NAMELEN) {
+    return -1;
+  }
+  for(i = 0; i < symbols->num_names; i++) {
+    if(strncmp(symbols->names[i], name, len) == 0 &&
+       symbols->names[i][len] == 0) {
+      return 26 + i;
+    }
+  }
+  return -1;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Like ubasic_symbols_find(), but gives a long name that is not there yet
+ * the next free slot. Returns -1 if the name is too long or the slots
+ * have run out.
+ */
+int
+ubasic_symbols_add(struct ubasic_symbols *symbols, const char *name, int len)
+{
+  int slot;
+
+  slot = ubasic_symbols_find(symbols, name, len);
+  if(slot >= 0 || symbols == NULL || len > UBASIC_MAX_NAMELEN ||
+     symbols->num_names == UBASIC_MAX_VARIABLES - 26) {
+    return slot;
+  }
+  memcpy(symbols->names[symbols->num_names], name, len);
+  symbols->names[symbols->num_names][len] = 0;
+  return 26 + symbols->num_names++;
+}
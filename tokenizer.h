@@ -56,6 +56,7 @@ enum {
   TOKENIZER_PEEK,
   TOKENIZER_POKE,
   TOKENIZER_END,
+  TOKENIZER_DIM,
   TOKENIZER_COMMA,
   TOKENIZER_SEMICOLON,
   TOKENIZER_PLUS,
@@ -72,12 +73,31 @@ enum {
   TOKENIZER_GT,
   TOKENIZER_EQ,
   TOKENIZER_CR,
+  /* Never produced by the tokenizer, only found in compiled code. */
+  TOKENIZER_EXPR,
+};
+
+/*
+ * Variables are numbered by slot. The one-letter variables a to z are
+ * slots 0 to 25. Longer names, a letter followed by letters, digits and
+ * underscores that ends where a keyword starts, are given the slots after
+ * that in the order in which they first appear in a program, and kept in
+ * its symbol table.
+ */
+#define UBASIC_MAX_VARIABLES 64
+#define UBASIC_MAX_NAMELEN 15
+
+struct ubasic_symbols {
+  int num_names;
+  char names[UBASIC_MAX_VARIABLES - 26][UBASIC_MAX_NAMELEN + 1];
 };
 
 typedef struct {
 	char const *ptr;
 	char const *nextptr;
 	int current_token;
+	/* Where ubasic_tokenizer_variable_num() looks up long names. */
+	const struct ubasic_symbols *symbols;
 } ubasic_tokenizer_info;
 
 void ubasic_tokenizer_goto(ubasic_tokenizer_info *info, const char *program);
@@ -93,4 +113,9 @@ void ubasic_tokenizer_error_print(ubasic_tokenizer_info *info);
 
 char const *ubasic_tokenizer_pos(ubasic_tokenizer_info *info);
 
+int ubasic_symbols_find(const struct ubasic_symbols *symbols,
+                        const char *name, int len);
+int ubasic_symbols_add(struct ubasic_symbols *symbols,
+                       const char *name, int len);
+
 #endif /* __TOKENIZER_H__ */
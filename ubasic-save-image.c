@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2006, Adam Dunkels
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "compiler.h"
+#include "image.h"
+
+/*---------------------------------------------------------------------------*/
+/*
+ * Compiles a uBASIC program and saves it as an image that
+ * ubasic_load_image() can load, see image.h.
+ */
+int
+main(int argc, char *argv[])
+{
+  struct ubasic_program *program;
+  FILE *file;
+  char *text;
+  long len;
+
+  if(argc != 3) {
+    fprintf(stderr, "usage: %s program.bas image\n", argv[0]);
+    return 2;
+  }
+
+  file = fopen(argv[1], "rb");
+  if(file == NULL || fseek(file, 0, SEEK_END) != 0 ||
+     (len = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0) {
+    perror(argv[1]);
+    return 1;
+  }
+  text = malloc(len + 1);
+  if(text == NULL || fread(text, 1, len, file) != (size_t)len) {
+    perror(argv[1]);
+    return 1;
+  }
+  text[len] = 0;
+  fclose(file);
+
+  program = ubasic_compiler_compile(text);
+  if(program == NULL) {
+    fprintf(stderr, "%s: out of memory\n", argv[1]);
+    return 1;
+  }
+  if(ubasic_save_image(program, argv[2]) != 0) {
+    perror(argv[2]);
+    return 1;
+  }
+
+  ubasic_compiler_free(program);
+  free(text);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
@@ -36,13 +36,66 @@
 #define DEBUG_PRINTF(...)
 #endif
 
+/* Use computed gotos for the statement dispatch in ubasic_run_until() where
+   the compiler supports them, and a plain loop over statement() otherwise. */
+#ifndef UBASIC_COMPUTED_GOTO
+#if defined(__GNUC__)
+#define UBASIC_COMPUTED_GOTO 1
+#else
+#define UBASIC_COMPUTED_GOTO 0
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define NORETURN __attribute__((noreturn))
+#define NOINLINE __attribute__((noinline))
+#else
+#define NORETURN
+#define NOINLINE
+#endif
+
 #include "ubasic.h"
 #include "tokenizer.h"
+#include "compiler.h"
+#include "arith.h"
+
+#if UBASIC_PROFILE
+#define PROFILE_LINE_BEGIN(info, line_number)                   \
+  do {                                                          \
+    if((info)->profile != NULL) {                               \
+      ubasic_profile_line_begin((info)->profile, line_number);  \
+    }                                                           \
+  } while(0)
+#define PROFILE_HOOK(info, hook)                                \
+  do {                                                          \
+    if((info)->profile != NULL) {                               \
+      ubasic_profile_##hook((info)->profile);                   \
+    }                                                           \
+  } while(0)
+#define PROFILE_CALLBACK(info, call)                            \
+  do {                                                          \
+    PROFILE_HOOK(info, callback_begin);                         \
+    call;                                                       \
+    PROFILE_HOOK(info, callback_end);                           \
+  } while(0)
+#else /* UBASIC_PROFILE */
+#define PROFILE_LINE_BEGIN(info, line_number)
+#define PROFILE_HOOK(info, hook)
+#define PROFILE_CALLBACK(info, call) call
+#endif /* UBASIC_PROFILE */
 
-// TODO need to abstract out printf
-#include <stdio.h> /* printf() */
-// TODO need to abstract out exit
-#include <stdlib.h> /* exit() */
+#include <string.h> /* memcpy() */
+#include <limits.h> /* INT_MAX */
+#include <setjmp.h> /* longjmp() */
+
+/* The most values a block POKE fill hands to the host at once. */
+#define BLOCK_FILL_LEN 32
+
+/* The default print functions write to the interpreter's output sink,
+   which is passed to them instead of the host's context. */
+#define PRINT_CONTEXT(info, function, default_function)         \
+  ((function) == (default_function) ?                           \
+   (void *)&(info)->output : (info)->app_context)
 
 //static char const *program_ptr;
 //static char string[MAX_STRINGLEN];
@@ -69,31 +122,63 @@
 //poke_func poke_function = NULL;
 
 /*---------------------------------------------------------------------------*/
+static int tokenizer_token(ubasic_info *info);
+static void tokenizer_next(ubasic_info *info);
+static VARIABLE_TYPE tokenizer_num(ubasic_info *info);
+static int tokenizer_arg(ubasic_info *info);
+static int tokenizer_variable_num(ubasic_info *info);
+static inline VARIABLE_TYPE get_variable(ubasic_info *info, int var);
+static inline void set_variable(ubasic_info *info, int var,
+                                VARIABLE_TYPE value);
+static void set_input(ubasic_info *info, int var, VARIABLE_TYPE value);
+static void tokenizer_string(ubasic_info *info, char *dest, int len);
+static int tokenizer_finished(ubasic_info *info);
+static int tokenizer_position(ubasic_info *info);
+static void tokenizer_jump(ubasic_info *info, int position);
+static void raise_error(ubasic_info *info, int error) NORETURN;
 static void accept(ubasic_info *info, int token);
-static int varfactor(ubasic_info *info);
-static int factor(ubasic_info *info);
-static int term(ubasic_info *info);
+static VARIABLE_TYPE *element1(ubasic_info *info, int array,
+                               VARIABLE_TYPE i);
+static VARIABLE_TYPE *element2(ubasic_info *info, int array,
+                               VARIABLE_TYPE i, VARIABLE_TYPE j);
+static VARIABLE_TYPE *array_element(ubasic_info *info, int array);
+static inline const struct ubasic_array *dimensioned(ubasic_info *info,
+                                                     int array);
+static VARIABLE_TYPE compiled_expr(ubasic_info *info);
+static VARIABLE_TYPE varfactor(ubasic_info *info);
+static VARIABLE_TYPE factor(ubasic_info *info);
+static VARIABLE_TYPE term(ubasic_info *info);
 static VARIABLE_TYPE expr(ubasic_info *info);
-static int relation(ubasic_info *info);
+static VARIABLE_TYPE relation(ubasic_info *info);
+static void init(ubasic_info *info, const char *text,
+                 const struct ubasic_program *program,
+                 const struct ubasic_allocator *allocator);
+static void reset(ubasic_info *info);
+static void arrays_reset(ubasic_info *info);
 static void index_free(ubasic_info *info);
 static char const* index_find(ubasic_info *info, int linenum);
-static void index_add(ubasic_info *info, int linenum, char const* sourcepos);
-static void jump_linenum_slow(ubasic_info *info, int linenum);
 static void jump_linenum(ubasic_info *info, int linenum);
 static void goto_statement(ubasic_info *info);
 static void print_statement(ubasic_info *info);
 static void if_statement(ubasic_info *info);
 static void let_statement(ubasic_info *info);
+static int dim_size(ubasic_info *info, VARIABLE_TYPE last);
+static void dim_statement(ubasic_info *info);
 static void gosub_statement(ubasic_info *info);
 static void return_statement(ubasic_info *info);
 static void next_statement(ubasic_info *info);
 static void for_statement(ubasic_info *info);
 static void input_statement(ubasic_info *info);
+static int block_count(ubasic_info *info, VARIABLE_TYPE count);
 static void peek_statement(ubasic_info *info);
+static void peek_block(ubasic_info *info, VARIABLE_TYPE peek_addr) NOINLINE;
 static void poke_statement(ubasic_info *info);
+static void poke_block(ubasic_info *info, VARIABLE_TYPE poke_addr,
+                       int count) NOINLINE;
 static void end_statement(ubasic_info *info);
 static void statement(ubasic_info *info);
 static void line_statement(ubasic_info *info);
+static int run_until(ubasic_info *info, int max_steps) NOINLINE;
 
 static void print_begin(void *context);
 static void print_num(VARIABLE_TYPE num, void *context);
@@ -103,19 +188,21 @@ static void print_end(void *context);
 /*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
-void
-ubasic_init(ubasic_info *info, const char *program)
+static void
+init(ubasic_info *info, const char *text,
+     const struct ubasic_program *program,
+     const struct ubasic_allocator *allocator)
 {
-  info->program_ptr = program;
-  info->for_stack_ptr = 0;
-  info->gosub_stack_ptr = 0;
+  info->program_ptr = text;
+  info->allocator = allocator != NULL ? *allocator : ubasic_malloc_allocator;
 
-  info->line_index_head = NULL;
-  info->line_index_current = NULL;
+  memset(&info->text_index, 0, sizeof(info->text_index));
 
   info->peek_function = NULL;
   info->poke_function = NULL;
   info->input_function = NULL;
+  info->peek_block_function = NULL;
+  info->poke_block_function = NULL;
 
   info->print_begin_function = print_begin;
   info->print_num_function = print_num;
@@ -129,44 +216,593 @@ ubasic_init(ubasic_info *info, const char *program)
   info->user_string_function = NULL;
   info->user_end_function = NULL;
 
-  index_free(info);
-  ubasic_tokenizer_init(&info->tokenizer_info, program);
+  ubasic_output_init(&info->output, NULL, 0);
+
+  info->program = program;
+  info->program_owned = 0;
+  info->symbols = program != NULL ? &program->symbols : NULL;
+  info->symbols_owned = 0;
+
+  /* Without stacks every GOSUB and FOR fails with a stack overflow, which
+     is as good a way as any to find out that there was no memory. */
+  info->gosub_stack = NULL;
+  info->gosub_stack_depth = 0;
+  info->for_stack = NULL;
+  info->for_stack_depth = 0;
+  ubasic_set_stack_depths(info, MAX_GOSUB_STACK_DEPTH, MAX_FOR_STACK_DEPTH);
+  /* Without a buffer, output is written out item by item. */
+  ubasic_set_output_size(info, UBASIC_OUTPUT_SIZE);
+  /* Without a pool, a compiled program that needs one cannot start. */
+  info->array_pool = NULL;
+  info->array_pool_size = 0;
+  ubasic_set_array_size(info, UBASIC_ARRAY_SIZE);
+
+#if UBASIC_PROFILE
+  info->profile = NULL;
+#endif
 
+  reset(info);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Puts the interpreter back at the start of its program, leaving the
+ * variables and callbacks alone.
+ */
+static void
+reset(ubasic_info *info)
+{
+  info->for_stack_ptr = 0;
+  info->gosub_stack_ptr = 0;
+  info->pc = 0;
+  if(info->program_ptr != NULL) {
+    ubasic_tokenizer_init(&info->tokenizer_info, info->program_ptr);
+  }
   info->ended = 0;
+  info->suspended = 0;
+  info->error = UBASIC_ERROR_NONE;
+  info->error_line_number = 0;
+  info->error_column = 0;
+  arrays_reset(info);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Empties the array pool and gives the arrays of a compiled program that
+ * have a constant size their storage. If they do not fit, the program is
+ * stopped before it starts, since its code counts on them. Like all
+ * arrays, they have no elements until their DIM runs.
+ */
+static void
+arrays_reset(ubasic_info *info)
+{
+  const struct ubasic_dim *dim;
+  struct ubasic_array *array;
+  int i, cells;
+
+  memset(info->arrays, 0, sizeof(info->arrays));
+  info->array_pool_used = 0;
+  if(info->program == NULL) {
+    return;
+  }
+  if(info->program->array_cells > info->array_pool_size) {
+    DEBUG_PRINTF("arrays_reset: no room for the arrays\n");
+    info->ended = 1;
+    info->error = UBASIC_ERROR_OUT_OF_MEMORY;
+    return;
+  }
+  for(i = 0; i < UBASIC_MAX_ARRAYS; i++) {
+    dim = &info->program->arrays[i];
+    if(dim->size1 > 0) {
+      cells = dim->size1 * (dim->size2 > 0 ? dim->size2 : 1);
+      array = &info->arrays[i];
+      array->values = info->array_pool + info->array_pool_used;
+      array->capacity = cells;
+      memset(array->values, 0, cells * sizeof(VARIABLE_TYPE));
+      info->array_pool_used += cells;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_init(ubasic_info *info, const char *program)
+{
+  ubasic_init_with(info, program, NULL);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Sets up the interpreter to allocate everything it needs with allocator,
+ * or with malloc() if it is NULL. Nothing is allocated after this.
+ * An interpreter that has been set up, in any of the ways there are, has
+ * to be freed with ubasic_free() before it is set up again, even with an
+ * arena allocator, since it still holds its allocations and output.
+ */
+void
+ubasic_init_with(ubasic_info *info, const char *program,
+                 const struct ubasic_allocator *allocator)
+{
+  struct ubasic_symbols *symbols;
+
+  init(info, program, NULL, allocator);
+  /* Without a symbol table only the variables a to z can be used. */
+  symbols = info->allocator.alloc(sizeof(struct ubasic_symbols),
+                                  info->allocator.context);
+  /* If the index could not be allocated the program still runs, but none
+     of its jumps will find their line and no long name its slot. */
+  ubasic_compiler_index(program, &info->text_index, symbols,
+                        &info->allocator);
+  if(symbols != NULL) {
+    info->symbols = symbols;
+    info->symbols_owned = 1;
+  }
+}
+/*---------------------------------------------------------------------------*/
+int
+ubasic_compile(ubasic_info *info, const char *program)
+{
+  return ubasic_compile_with(info, program, NULL);
+}
+/*---------------------------------------------------------------------------*/
+int
+ubasic_compile_with(ubasic_info *info, const char *program,
+                    const struct ubasic_allocator *allocator)
+{
+  struct ubasic_program *compiled;
+
+  compiled = ubasic_compiler_compile_with(program, allocator);
+  if(compiled == NULL) {
+    /* Keep going with the plain text interpreter. */
+    ubasic_init_with(info, program, allocator);
+    return -1;
+  }
+  init(info, program, compiled, allocator);
+  info->program_owned = 1;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_init_program(ubasic_info *info, const struct ubasic_program *program)
+{
+  ubasic_init_program_with(info, program, NULL);
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_init_program_with(ubasic_info *info,
+                         const struct ubasic_program *program,
+                         const struct ubasic_allocator *allocator)
+{
+  init(info, NULL, program, allocator);
+}
+/*---------------------------------------------------------------------------*/
+void
+ubasic_free(ubasic_info *info)
+{
+  index_free(info);
+  if(info->program_owned) {
+    ubasic_compiler_free((struct ubasic_program *)info->program);
+    info->program_owned = 0;
+  }
+  info->program = NULL;
+  if(info->symbols_owned) {
+    info->allocator.free((struct ubasic_symbols *)info->symbols,
+                         info->allocator.context);
+    info->symbols_owned = 0;
+  }
+  info->symbols = NULL;
+  /* The GOSUB stack shares its allocation with the FOR stack. */
+  if(info->for_stack != NULL) {
+    info->allocator.free(info->for_stack, info->allocator.context);
+    info->for_stack = NULL;
+    info->gosub_stack = NULL;
+  }
+  info->for_stack_depth = 0;
+  info->gosub_stack_depth = 0;
+  ubasic_output_flush(&info->output);
+  if(info->output.buffer != NULL) {
+    info->allocator.free(info->output.buffer, info->allocator.context);
+    info->output.buffer = NULL;
+    info->output.size = 0;
+  }
+  if(info->array_pool != NULL) {
+    info->allocator.free(info->array_pool, info->allocator.context);
+    info->array_pool = NULL;
+  }
+  info->array_pool_size = 0;
+  memset(info->arrays, 0, sizeof(info->arrays));
+#if UBASIC_PROFILE
+  ubasic_profile_free(info->profile);
+  info->profile = NULL;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * The tokenizer_*() functions below read the current token either from the
+ * program text, through the tokenizer, or from the compiled token stream
+ * when the program was set up with ubasic_compile().
+ */
+static int
+tokenizer_token(ubasic_info *info)
+{
+  if(info->program != NULL) {
+    return info->program->code[info->pc].token;
+  }
+  return ubasic_tokenizer_token(&info->tokenizer_info);
+}
+/*---------------------------------------------------------------------------*/
+static void
+tokenizer_next(ubasic_info *info)
+{
+  if(info->program != NULL) {
+    if(info->program->code[info->pc].token != TOKENIZER_ENDOFINPUT) {
+      info->pc++;
+    }
+    return;
+  }
+  ubasic_tokenizer_next(&info->tokenizer_info);
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE
+tokenizer_num(ubasic_info *info)
+{
+  if(info->program != NULL) {
+    if(info->program->code[info->pc].token == TOKENIZER_NUMBER) {
+      return info->program->code[info->pc].arg;
+    }
+    return 0;
+  }
+  return ubasic_tokenizer_num(&info->tokenizer_info);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * The arg that the compiler gives the current token, which program text
+ * keeps in its index, where it is -1 for tokens that have none.
+ */
+static int
+tokenizer_arg(ubasic_info *info)
+{
+  if(info->program != NULL) {
+    return info->program->code[info->pc].arg;
+  }
+  return ubasic_compiler_find_arg(info->text_index.args,
+                                  info->text_index.num_args,
+                                  tokenizer_position(info));
+}
+/*---------------------------------------------------------------------------*/
+static int
+tokenizer_variable_num(ubasic_info *info)
+{
+  ubasic_tokenizer_info *tokenizer;
+  int var;
+
+  if(info->program != NULL) {
+    return info->program->code[info->pc].arg;
+  }
+  tokenizer = &info->tokenizer_info;
+  if(tokenizer->nextptr == tokenizer->ptr + 1) {
+    return *tokenizer->ptr - 'a';
+  }
+  /* Long names were given their slots when the program was set up, and
+     only a name that did not fit in the symbol table has none. */
+  var = tokenizer_arg(info);
+  if(var < 0) {
+    raise_error(info, UBASIC_ERROR_SYNTAX);
+  }
+  return var;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * The interpreter's own variable accesses. Slots come from
+ * tokenizer_variable_num() after the token has been accepted as a
+ * variable, so they are always in range and need no check.
+ */
+static inline VARIABLE_TYPE
+get_variable(ubasic_info *info, int var)
+{
+  return info->variables[var];
+}
+/*---------------------------------------------------------------------------*/
+static inline void
+set_variable(ubasic_info *info, int var, VARIABLE_TYPE value)
+{
+  info->variables[var] = value;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Stores the value that an input or peek callback returned, unless the
+ * callback suspended the program, in which case the value is supplied
+ * later with ubasic_resume(). The statement has been read to its end by
+ * then, so that all that is left to do on resuming is the store.
+ */
+static void
+set_input(ubasic_info *info, int var, VARIABLE_TYPE value)
+{
+  if(info->suspended) {
+    info->suspended_var = var;
+    return;
+  }
+  set_variable(info, var, value);
+}
+/*---------------------------------------------------------------------------*/
+static void
+tokenizer_string(ubasic_info *info, char *dest, int len)
+{
+  const char *str;
+  int string_len;
+
+  if(info->program == NULL) {
+    ubasic_tokenizer_string(&info->tokenizer_info, dest, len);
+    return;
+  }
+  if(info->program->code[info->pc].token != TOKENIZER_STRING) {
+    return;
+  }
+  str = info->program->strings + info->program->code[info->pc].arg;
+  string_len = strlen(str);
+  if(len <= string_len) {
+    string_len = len - 1;
+  }
+  memcpy(dest, str, string_len);
+  dest[string_len] = 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+tokenizer_finished(ubasic_info *info)
+{
+  if(info->program != NULL) {
+    return info->program->code[info->pc].token == TOKENIZER_ENDOFINPUT;
+  }
+  return ubasic_tokenizer_finished(&info->tokenizer_info);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Positions are offsets into the compiled code or into the program text,
+ * so that going back to one is an assignment rather than a line lookup.
+ */
+static int
+tokenizer_position(ubasic_info *info)
+{
+  if(info->program != NULL) {
+    return info->pc;
+  }
+  return ubasic_tokenizer_pos(&info->tokenizer_info) - info->program_ptr;
+}
+/*---------------------------------------------------------------------------*/
+static void
+tokenizer_jump(ubasic_info *info, int position)
+{
+  if(info->program != NULL) {
+    info->pc = position;
+    return;
+  }
+  ubasic_tokenizer_goto(&info->tokenizer_info, info->program_ptr + position);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Ends the program with an error at the current token and goes back to
+ * ubasic_run() or ubasic_run_until(). Nothing on the way checks for
+ * errors, so the interpreter does not pay for them until one happens.
+ */
+static void
+raise_error(ubasic_info *info, int error)
+{
+  const struct ubasic_line *lines;
+  int num_lines;
+  int pos, line_pc;
+  int i;
+
+  info->error = error;
+  info->ended = 1;
+
+  /* The line is the one that starts closest before the token. */
+  pos = tokenizer_position(info);
+  if(info->program != NULL) {
+    lines = info->program->lines;
+    num_lines = info->program->num_lines;
+    info->error_column = info->program->columns[pos];
+  } else {
+    lines = info->text_index.lines;
+    num_lines = info->text_index.num_lines;
+    for(i = pos; i > 0 && info->program_ptr[i - 1] != '\n'; i--);
+    info->error_column = pos - i + 1;
+  }
+  info->error_line_number = 0;
+  line_pc = -1;
+  for(i = 0; i < num_lines; i++) {
+    if(lines[i].pc <= pos && lines[i].pc > line_pc) {
+      line_pc = lines[i].pc;
+      info->error_line_number = lines[i].line_number;
+    }
+  }
+
+  DEBUG_PRINTF("raise_error: error %d at line %d, column %d\n", error,
+               info->error_line_number, info->error_column);
+  ubasic_output_flush(&info->output);
+  longjmp(info->error_jump, 1);
 }
 /*---------------------------------------------------------------------------*/
 static void
 accept(ubasic_info *info, int token)
 {
-  if(token != ubasic_tokenizer_token(&info->tokenizer_info)) {
+  if(token != tokenizer_token(info)) {
     DEBUG_PRINTF("Token not what was expected (expected %d, got %d)\n",
-                token, ubasic_tokenizer_token(&info->tokenizer_info));
+                token, tokenizer_token(info));
     ubasic_tokenizer_error_print(&info->tokenizer_info);
-    exit(1);
+    raise_error(info, UBASIC_ERROR_SYNTAX);
   }
   DEBUG_PRINTF("Expected %d, got it\n", token);
-  ubasic_tokenizer_next(&info->tokenizer_info);
+  tokenizer_next(info);
 }
 /*---------------------------------------------------------------------------*/
-static int
+/*
+ * element1() and element2() find an element of an array of one or two
+ * dimensions, ending the program if there is no such element.
+ */
+static VARIABLE_TYPE *
+element1(ubasic_info *info, int array, VARIABLE_TYPE i)
+{
+  const struct ubasic_array *a = &info->arrays[array];
+
+  if(a->size2 != 0 || i < 0 || VARIABLE_TO_INT(i) >= a->size1) {
+    raise_error(info, UBASIC_ERROR_OUT_OF_RANGE);
+  }
+  return &a->values[VARIABLE_TO_INT(i)];
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE *
+element2(ubasic_info *info, int array, VARIABLE_TYPE i, VARIABLE_TYPE j)
+{
+  const struct ubasic_array *a = &info->arrays[array];
+
+  if(a->size2 == 0 || i < 0 || VARIABLE_TO_INT(i) >= a->size1 ||
+     j < 0 || VARIABLE_TO_INT(j) >= a->size2) {
+    raise_error(info, UBASIC_ERROR_OUT_OF_RANGE);
+  }
+  return &a->values[VARIABLE_TO_INT(i) * a->size2 + VARIABLE_TO_INT(j)];
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * An access whose indices the compiler has proved to be in bounds still
+ * needs the DIM of its array to have run, which has the sizes the
+ * compiler counted on.
+ */
+static inline const struct ubasic_array *
+dimensioned(ubasic_info *info, int array)
+{
+  const struct ubasic_array *a = &info->arrays[array];
+
+  if(a->size1 == 0) {
+    raise_error(info, UBASIC_ERROR_OUT_OF_RANGE);
+  }
+  return a;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Reads the indices of an element of array, from the opening parenthesis
+ * on, and finds the element. In compiled code the parenthesis says
+ * whether the indices have already been proved to be in bounds.
+ */
+static VARIABLE_TYPE *
+array_element(ubasic_info *info, int array)
+{
+  const struct ubasic_array *a;
+  VARIABLE_TYPE i, j;
+  int checked;
+
+  checked = info->program == NULL || info->program->code[info->pc].arg == 0;
+  accept(info, TOKENIZER_LEFTPAREN);
+  i = expr(info);
+  if(tokenizer_token(info) == TOKENIZER_COMMA) {
+    accept(info, TOKENIZER_COMMA);
+    j = expr(info);
+    accept(info, TOKENIZER_RIGHTPAREN);
+    if(checked) {
+      return element2(info, array, i, j);
+    }
+    a = dimensioned(info, array);
+    return &a->values[VARIABLE_TO_INT(i) * a->size2 + VARIABLE_TO_INT(j)];
+  }
+  accept(info, TOKENIZER_RIGHTPAREN);
+  if(checked) {
+    return element1(info, array, i);
+  }
+  return &dimensioned(info, array)->values[VARIABLE_TO_INT(i)];
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Evaluates the compiled expression at the current TOKENIZER_EXPR cell and
+ * moves past it.
+ */
+static VARIABLE_TYPE
+compiled_expr(ubasic_info *info)
+{
+  const struct ubasic_expr *e;
+  const struct ubasic_op *op, *end;
+  const struct ubasic_array *a;
+  VARIABLE_TYPE stack[UBASIC_EXPR_STACK_DEPTH];
+  VARIABLE_TYPE *sp;
+  VARIABLE_TYPE *variables;
+
+  e = &info->program->exprs[info->program->code[info->pc].arg];
+  info->pc = e->end;
+  variables = info->variables;
+
+  switch(e->kind) {
+  case UBASIC_EXPR_CONST:
+    return e->value;
+  case UBASIC_EXPR_VAR:
+    return variables[e->var];
+  case UBASIC_EXPR_VAR_ADD_CONST:
+    return arith_add(variables[e->var], e->value, &info->error);
+  case UBASIC_EXPR_VAR_SUB_CONST:
+    return arith_sub(variables[e->var], e->value, &info->error);
+  case UBASIC_EXPR_VAR_MUL_VAR:
+    return arith_mul(variables[e->var], variables[e->var2], &info->error);
+  case UBASIC_EXPR_VAR_LT_CONST:
+    return VARIABLE_FROM_INT(variables[e->var] < e->value);
+  case UBASIC_EXPR_VAR_GT_CONST:
+    return VARIABLE_FROM_INT(variables[e->var] > e->value);
+  case UBASIC_EXPR_VAR_EQ_CONST:
+    return VARIABLE_FROM_INT(variables[e->var] == e->value);
+  }
+
+  sp = stack;
+  op = info->program->ops + e->first_op;
+  for(end = op + e->num_ops; op < end; op++) {
+    switch(op->op) {
+    case TOKENIZER_NUMBER:
+      *sp++ = op->arg;
+      break;
+    case TOKENIZER_VARIABLE:
+      *sp++ = variables[op->arg];
+      break;
+    case UBASIC_OP_ELEMENT:
+      sp[-1] = *element1(info, op->arg, sp[-1]);
+      break;
+    case UBASIC_OP_ELEMENT2:
+      sp--;
+      sp[-1] = *element2(info, op->arg, sp[-1], sp[0]);
+      break;
+    case UBASIC_OP_ELEMENT_UNCHECKED:
+      sp[-1] = dimensioned(info, op->arg)->values[VARIABLE_TO_INT(sp[-1])];
+      break;
+    case UBASIC_OP_ELEMENT2_UNCHECKED:
+      sp--;
+      a = dimensioned(info, op->arg);
+      sp[-1] = a->values[VARIABLE_TO_INT(sp[-1]) * a->size2 +
+                         VARIABLE_TO_INT(sp[0])];
+      break;
+    default:
+      sp--;
+      sp[-1] = arith_binary(op->op, sp[-1], sp[0], &info->error);
+      break;
+    }
+  }
+  return stack[0];
+}
+/*---------------------------------------------------------------------------*/
+static VARIABLE_TYPE
 varfactor(ubasic_info *info)
 {
-  int r;
+  VARIABLE_TYPE r;
+  int var;
+
   DEBUG_PRINTF("varfactor: obtaining %d from variable %d\n", variables[ubasic_tokenizer_variable_num()], ubasic_tokenizer_variable_num());
-  r = ubasic_get_variable(info, ubasic_tokenizer_variable_num(&info->tokenizer_info));
+  var = tokenizer_variable_num(info);
   accept(info, TOKENIZER_VARIABLE);
+  if(tokenizer_token(info) == TOKENIZER_LEFTPAREN) {
+    return *array_element(info, var);
+  }
+  r = get_variable(info, var);
   return r;
 }
 /*---------------------------------------------------------------------------*/
-static int
+static VARIABLE_TYPE
 factor(ubasic_info *info)
 {
-  int r;
+  VARIABLE_TYPE r;
 
-  DEBUG_PRINTF("factor: token %d\n", ubasic_tokenizer_token(&info->tokenizer_info));
-  switch(ubasic_tokenizer_token(&info->tokenizer_info)) {
+  DEBUG_PRINTF("factor: token %d\n", tokenizer_token(info));
+  switch(tokenizer_token(info)) {
   case TOKENIZER_NUMBER:
-    r = ubasic_tokenizer_num(&info->tokenizer_info);
+    r = VARIABLE_FROM_INT(tokenizer_num(info));
     DEBUG_PRINTF("factor: number %d\n", r);
     accept(info, TOKENIZER_NUMBER);
     break;
@@ -182,33 +818,33 @@ factor(ubasic_info *info)
   return r;
 }
 /*---------------------------------------------------------------------------*/
-static int
+static VARIABLE_TYPE
 term(ubasic_info *info)
 {
-  int f1, f2;
+  VARIABLE_TYPE f1, f2;
   int op;
 
   f1 = factor(info);
-  op = ubasic_tokenizer_token(&info->tokenizer_info);
+  op = tokenizer_token(info);
   DEBUG_PRINTF("term: token %d\n", op);
   while(op == TOKENIZER_ASTR ||
        op == TOKENIZER_SLASH ||
        op == TOKENIZER_MOD) {
-    ubasic_tokenizer_next(&info->tokenizer_info);
+    tokenizer_next(info);
     f2 = factor(info);
     DEBUG_PRINTF("term: %d %d %d\n", f1, op, f2);
     switch(op) {
     case TOKENIZER_ASTR:
-      f1 = f1 * f2;
+      f1 = arith_mul(f1, f2, &info->error);
       break;
     case TOKENIZER_SLASH:
-      f1 = f1 / f2;
+      f1 = arith_div(f1, f2, &info->error);
       break;
     case TOKENIZER_MOD:
-      f1 = f1 % f2;
+      f1 = arith_mod(f1, f2, &info->error);
       break;
     }
-    op = ubasic_tokenizer_token(&info->tokenizer_info);
+    op = tokenizer_token(info);
   }
   DEBUG_PRINTF("term: %d\n", f1);
   return f1;
@@ -217,25 +853,34 @@ term(ubasic_info *info)
 static VARIABLE_TYPE
 expr(ubasic_info *info)
 {
-  int t1, t2;
+  VARIABLE_TYPE t1, t2;
   int op;
 
+  if(info->program != NULL &&
+     info->program->code[info->pc].token == TOKENIZER_EXPR) {
+    t1 = compiled_expr(info);
+    if(info->error != UBASIC_ERROR_NONE) {
+      raise_error(info, info->error);
+    }
+    return t1;
+  }
+
   t1 = term(info);
-  op = ubasic_tokenizer_token(&info->tokenizer_info);
+  op = tokenizer_token(info);
   DEBUG_PRINTF("expr: token %d\n", op);
   while(op == TOKENIZER_PLUS ||
        op == TOKENIZER_MINUS ||
        op == TOKENIZER_AND ||
        op == TOKENIZER_OR) {
-    ubasic_tokenizer_next(&info->tokenizer_info);
+    tokenizer_next(info);
     t2 = term(info);
     DEBUG_PRINTF("expr: %d %d %d\n", t1, op, t2);
     switch(op) {
     case TOKENIZER_PLUS:
-      t1 = t1 + t2;
+      t1 = arith_add(t1, t2, &info->error);
       break;
     case TOKENIZER_MINUS:
-      t1 = t1 - t2;
+      t1 = arith_sub(t1, t2, &info->error);
       break;
     case TOKENIZER_AND:
       t1 = t1 & t2;
@@ -244,147 +889,97 @@ expr(ubasic_info *info)
       t1 = t1 | t2;
       break;
     }
-    op = ubasic_tokenizer_token(&info->tokenizer_info);
+    op = tokenizer_token(info);
   }
   DEBUG_PRINTF("expr: %d\n", t1);
+  if(info->error != UBASIC_ERROR_NONE) {
+    raise_error(info, info->error);
+  }
   return t1;
 }
 /*---------------------------------------------------------------------------*/
-static int
+static VARIABLE_TYPE
 relation(ubasic_info *info)
 {
-  int r1, r2;
+  VARIABLE_TYPE r1, r2;
   int op;
 
+  /* In compiled code the whole relation of an IF is one expression,
+     which expr() runs. */
   r1 = expr(info);
-  op = ubasic_tokenizer_token(&info->tokenizer_info);
+  op = tokenizer_token(info);
   DEBUG_PRINTF("relation: token %d\n", op);
   while(op == TOKENIZER_LT ||
        op == TOKENIZER_GT ||
        op == TOKENIZER_EQ) {
-    ubasic_tokenizer_next(&info->tokenizer_info);
+    tokenizer_next(info);
     r2 = expr(info);
     DEBUG_PRINTF("relation: %d %d %d\n", r1, op, r2);
     switch(op) {
     case TOKENIZER_LT:
-      r1 = r1 < r2;
+      r1 = VARIABLE_FROM_INT(r1 < r2);
       break;
     case TOKENIZER_GT:
-      r1 = r1 > r2;
+      r1 = VARIABLE_FROM_INT(r1 > r2);
       break;
     case TOKENIZER_EQ:
-      r1 = r1 == r2;
+      r1 = VARIABLE_FROM_INT(r1 == r2);
       break;
     }
-    op = ubasic_tokenizer_token(&info->tokenizer_info);
+    op = tokenizer_token(info);
   }
   return r1;
 }
 /*---------------------------------------------------------------------------*/
 static void
 index_free(ubasic_info *info) {
-  if(info->line_index_head != NULL) {
-    info->line_index_current = info->line_index_head;
-    do {
-      DEBUG_PRINTF("Freeing index for line %d.\n", line_index_current);
-      info->line_index_head = info->line_index_current;
-      info->line_index_current = info->line_index_current->next;
-      free(info->line_index_head);
-    } while (info->line_index_current != NULL);
-    info->line_index_head = NULL;
-  }
+  ubasic_compiler_index_free(&info->text_index, &info->allocator);
 }
 /*---------------------------------------------------------------------------*/
 static char const*
 index_find(ubasic_info *info, int linenum) {
-  struct ubasic_line_index *lidx;
-  lidx = info->line_index_head;
-
-  #if DEBUG
-  int step = 0;
-  #endif
+  int pos;
 
-  while(lidx != NULL && lidx->line_number != linenum) {
-    lidx = lidx->next;
-
-    #if DEBUG
-    if(lidx != NULL) {
-      DEBUG_PRINTF("index_find: Step %3d. Found index for line %d: %d.\n",
-                   step, lidx->line_number,
-                   lidx->program_text_position);
-    }
-    step++;
-    #endif
-  }
-  if(lidx != NULL && lidx->line_number == linenum) {
+  pos = ubasic_compiler_find_line(info->text_index.lines,
+                                  info->text_index.num_lines,
+                                  linenum);
+  if(pos >= 0) {
     DEBUG_PRINTF("index_find: Returning index for line %d.\n", linenum);
-    return lidx->program_text_position;
+    return info->program_ptr + pos;
   }
   DEBUG_PRINTF("index_find: Returning NULL.\n", linenum);
   return NULL;
 }
 /*---------------------------------------------------------------------------*/
 static void
-index_add(ubasic_info *info, int linenum, char const* sourcepos) {
-  if(info->line_index_head != NULL && index_find(info, linenum)) {
+jump_linenum(ubasic_info *info, int linenum)
+{
+  if(info->program != NULL) {
+    info->pc = ubasic_compiler_find_line(info->program->lines,
+                                         info->program->num_lines, linenum);
+    if(info->pc < 0) {
+      DEBUG_PRINTF("jump_linenum: Line %d not found.\n", linenum);
+      info->pc = info->program->code_len - 1;
+    }
     return;
   }
 
-  struct ubasic_line_index *new_lidx;
-
-  new_lidx = malloc(sizeof(struct ubasic_line_index));
-  new_lidx->line_number = linenum;
-  new_lidx->program_text_position = sourcepos;
-  new_lidx->next = NULL;
-
-  if(info->line_index_head != NULL) {
-    info->line_index_current->next = new_lidx;
-    info->line_index_current = info->line_index_current->next;
-  } else {
-    info->line_index_current = new_lidx;
-    info->line_index_head = info->line_index_current;
-  }
-  DEBUG_PRINTF("index_add: Adding index for line %d: %d.\n", linenum,
-               sourcepos);
-}
-/*---------------------------------------------------------------------------*/
-static void
-jump_linenum_slow(ubasic_info *info, int linenum)
-{
-  ubasic_tokenizer_init(&info->tokenizer_info, info->program_ptr);
-  while(ubasic_tokenizer_num(&info->tokenizer_info) != linenum) {
-    do {
-      do {
-        ubasic_tokenizer_next(&info->tokenizer_info);
-      } while(ubasic_tokenizer_token(&info->tokenizer_info) != TOKENIZER_CR &&
-          ubasic_tokenizer_token(&info->tokenizer_info) != TOKENIZER_ENDOFINPUT);
-      if(ubasic_tokenizer_token(&info->tokenizer_info) == TOKENIZER_CR) {
-        ubasic_tokenizer_next(&info->tokenizer_info);
-      }
-    } while(ubasic_tokenizer_token(&info->tokenizer_info) != TOKENIZER_NUMBER);
-    DEBUG_PRINTF("jump_linenum_slow: Found line %d\n", ubasic_tokenizer_num());
-  }
-}
-/*---------------------------------------------------------------------------*/
-static void
-jump_linenum(ubasic_info *info, int linenum)
-{
+  /* Every line is indexed up front, so a line that is not in the index
+     does not exist and the jump runs off the end of the program. */
   char const* pos = index_find(info, linenum);
-  if(pos != NULL) {
-    DEBUG_PRINTF("jump_linenum: Going to line %d.\n", linenum);
-    ubasic_tokenizer_goto(&info->tokenizer_info, pos);
-  } else {
-    /* We'll try to find a yet-unindexed line to jump to. */
-    DEBUG_PRINTF("jump_linenum: Calling jump_linenum_slow.\n", linenum);
-    jump_linenum_slow(info, linenum);
+  if(pos == NULL) {
+    DEBUG_PRINTF("jump_linenum: Line %d not found.\n", linenum);
+    pos = info->program_ptr + strlen(info->program_ptr);
   }
+  DEBUG_PRINTF("jump_linenum: Going to line %d.\n", linenum);
+  ubasic_tokenizer_goto(&info->tokenizer_info, pos);
 }
 /*---------------------------------------------------------------------------*/
 static void
 goto_statement(ubasic_info *info)
 {
   accept(info, TOKENIZER_GOTO);
-  jump_linenum(info, ubasic_tokenizer_num(&info->tokenizer_info));
+  jump_linenum(info, tokenizer_num(info));
 }
 /*---------------------------------------------------------------------------*/
 static void
@@ -393,103 +988,193 @@ print_statement(ubasic_info *info)
   accept(info, TOKENIZER_PRINT);
 
   if(info->print_begin_function != NULL) {
-	  info->print_begin_function(info->app_context);
+	  PROFILE_CALLBACK(info, info->print_begin_function(
+        PRINT_CONTEXT(info, info->print_begin_function, print_begin)));
   }
 
   do {
     DEBUG_PRINTF("Print loop\n");
-    if(ubasic_tokenizer_token(&info->tokenizer_info) == TOKENIZER_STRING) {
-      ubasic_tokenizer_string(&info->tokenizer_info, info->string, sizeof(info->string));
+    if(tokenizer_token(info) == TOKENIZER_STRING) {
+      tokenizer_string(info, info->string, sizeof(info->string));
 
       if(info->print_string_function != NULL) {
-    	  info->print_string_function(info->string, info->app_context);
+    	  PROFILE_CALLBACK(info, info->print_string_function(info->string,
+          PRINT_CONTEXT(info, info->print_string_function, print_string)));
       }
 
-      ubasic_tokenizer_next(&info->tokenizer_info);
-    } else if(ubasic_tokenizer_token(&info->tokenizer_info) == TOKENIZER_COMMA) {
+      tokenizer_next(info);
+    } else if(tokenizer_token(info) == TOKENIZER_COMMA) {
 
     	if(info->print_separator_function != NULL) {
-    		info->print_separator_function(',', info->app_context);
+    		PROFILE_CALLBACK(info, info->print_separator_function(',',
+          PRINT_CONTEXT(info, info->print_separator_function,
+                        print_separator)));
     	}
 
-      ubasic_tokenizer_next(&info->tokenizer_info);
-    } else if(ubasic_tokenizer_token(&info->tokenizer_info) == TOKENIZER_SEMICOLON) {
-      ubasic_tokenizer_next(&info->tokenizer_info);
-    } else if(ubasic_tokenizer_token(&info->tokenizer_info) == TOKENIZER_VARIABLE ||
-          ubasic_tokenizer_token(&info->tokenizer_info) == TOKENIZER_NUMBER) {
+      tokenizer_next(info);
+    } else if(tokenizer_token(info) == TOKENIZER_SEMICOLON) {
+      tokenizer_next(info);
+    } else if(tokenizer_token(info) == TOKENIZER_VARIABLE ||
+              tokenizer_token(info) == TOKENIZER_NUMBER ||
+              tokenizer_token(info) == TOKENIZER_EXPR) {
 
     	if(info->print_num_function != NULL) {
-    		info->print_num_function(expr(info), info->app_context);
+    		VARIABLE_TYPE num = expr(info);
+    		PROFILE_CALLBACK(info, info->print_num_function(num,
+          PRINT_CONTEXT(info, info->print_num_function, print_num)));
     	}
     } else {
       break;
     }
-  } while(ubasic_tokenizer_token(&info->tokenizer_info) != TOKENIZER_CR &&
-      ubasic_tokenizer_token(&info->tokenizer_info) != TOKENIZER_ENDOFINPUT);
+  } while(tokenizer_token(info) != TOKENIZER_CR &&
+      tokenizer_token(info) != TOKENIZER_ENDOFINPUT);
 
   if(info->print_end_function != NULL) {
-	  info->print_end_function(info->app_context);
+	  PROFILE_CALLBACK(info, info->print_end_function(
+        PRINT_CONTEXT(info, info->print_end_function, print_end)));
   }
   DEBUG_PRINTF("End of print\n");
-  ubasic_tokenizer_next(&info->tokenizer_info);
+  tokenizer_next(info);
 }
 /*---------------------------------------------------------------------------*/
 static void
 if_statement(ubasic_info *info)
 {
-  int r;
+  VARIABLE_TYPE r;
+  int skip;
 
   accept(info, TOKENIZER_IF);
 
   r = relation(info);
   DEBUG_PRINTF("if_statement: relation %d\n", r);
-  accept(info, TOKENIZER_THEN);
   if(r) {
+    accept(info, TOKENIZER_THEN);
     statement(info);
+    return;
+  }
+  if(tokenizer_token(info) == TOKENIZER_THEN &&
+     (skip = tokenizer_arg(info)) >= 0) {
+    /* Where the THEN clause ends was found when the program was set up. */
+    tokenizer_jump(info, skip);
   } else {
+    accept(info, TOKENIZER_THEN);
     do {
-      ubasic_tokenizer_next(&info->tokenizer_info);
-    } while(ubasic_tokenizer_token(&info->tokenizer_info) != TOKENIZER_ELSE &&
-        ubasic_tokenizer_token(&info->tokenizer_info) != TOKENIZER_CR &&
-        ubasic_tokenizer_token(&info->tokenizer_info) != TOKENIZER_ENDOFINPUT);
-    if(ubasic_tokenizer_token(&info->tokenizer_info) == TOKENIZER_ELSE) {
-      ubasic_tokenizer_next(&info->tokenizer_info);
-      statement(info);
-    } else if(ubasic_tokenizer_token(&info->tokenizer_info) == TOKENIZER_CR) {
-      ubasic_tokenizer_next(&info->tokenizer_info);
-    }
+      tokenizer_next(info);
+    } while(tokenizer_token(info) != TOKENIZER_ELSE &&
+        tokenizer_token(info) != TOKENIZER_CR &&
+        tokenizer_token(info) != TOKENIZER_ENDOFINPUT);
+  }
+  if(tokenizer_token(info) == TOKENIZER_ELSE) {
+    tokenizer_next(info);
+    statement(info);
+  } else if(tokenizer_token(info) == TOKENIZER_CR) {
+    tokenizer_next(info);
   }
 }
 /*---------------------------------------------------------------------------*/
 static void
 let_statement(ubasic_info *info)
 {
+  VARIABLE_TYPE *element;
   int var;
 
-  var = ubasic_tokenizer_variable_num(&info->tokenizer_info);
+  var = tokenizer_variable_num(info);
 
   accept(info, TOKENIZER_VARIABLE);
+  if(tokenizer_token(info) == TOKENIZER_LEFTPAREN) {
+    /* Nothing the value can do moves the element. */
+    element = array_element(info, var);
+    accept(info, TOKENIZER_EQ);
+    *element = expr(info);
+    accept(info, TOKENIZER_CR);
+    return;
+  }
   accept(info, TOKENIZER_EQ);
-  ubasic_set_variable(info, var, expr(info));
+  set_variable(info, var, expr(info));
   DEBUG_PRINTF("let_statement: assign %d to %d\n", variables[var], var);
   accept(info, TOKENIZER_CR);
 
 }
 /*---------------------------------------------------------------------------*/
+/*
+ * Makes the number of elements along a dimension from the last index.
+ */
+static int
+dim_size(ubasic_info *info, VARIABLE_TYPE last)
+{
+  if(last < 0 || VARIABLE_TO_INT(last) >= info->array_pool_size) {
+    raise_error(info, UBASIC_ERROR_OUT_OF_MEMORY);
+  }
+  return VARIABLE_TO_INT(last) + 1;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * DIM a(n) makes a an array with elements 0 to n, and DIM a(n, m) one
+ * with n + 1 rows of m + 1 elements, all 0. An array that is made again
+ * keeps its storage if it fits.
+ */
+static void
+dim_statement(ubasic_info *info)
+{
+  struct ubasic_array *array;
+  int size1, size2, cells;
+
+  accept(info, TOKENIZER_DIM);
+  for(;;) {
+    array = &info->arrays[tokenizer_variable_num(info)];
+    accept(info, TOKENIZER_VARIABLE);
+    accept(info, TOKENIZER_LEFTPAREN);
+    size1 = dim_size(info, expr(info));
+    size2 = 0;
+    if(tokenizer_token(info) == TOKENIZER_COMMA) {
+      accept(info, TOKENIZER_COMMA);
+      size2 = dim_size(info, expr(info));
+    }
+    accept(info, TOKENIZER_RIGHTPAREN);
+
+    cells = size1;
+    if(size2 > 0) {
+      if(size1 > info->array_pool_size / size2) {
+        raise_error(info, UBASIC_ERROR_OUT_OF_MEMORY);
+      }
+      cells = size1 * size2;
+    }
+    if(cells > array->capacity) {
+      if(cells > info->array_pool_size - info->array_pool_used) {
+        raise_error(info, UBASIC_ERROR_OUT_OF_MEMORY);
+      }
+      array->values = info->array_pool + info->array_pool_used;
+      array->capacity = cells;
+      info->array_pool_used += cells;
+    }
+    array->size1 = size1;
+    array->size2 = size2;
+    memset(array->values, 0, cells * sizeof(VARIABLE_TYPE));
+
+    if(tokenizer_token(info) != TOKENIZER_COMMA) {
+      break;
+    }
+    accept(info, TOKENIZER_COMMA);
+  }
+  accept(info, TOKENIZER_CR);
+}
+/*---------------------------------------------------------------------------*/
 static void
 gosub_statement(ubasic_info *info)
 {
   int linenum;
   accept(info, TOKENIZER_GOSUB);
-  linenum = ubasic_tokenizer_num(&info->tokenizer_info);
+  linenum = tokenizer_num(info);
   accept(info, TOKENIZER_NUMBER);
   accept(info, TOKENIZER_CR);
-  if(info->gosub_stack_ptr < MAX_GOSUB_STACK_DEPTH) {
-    info->gosub_stack[info->gosub_stack_ptr] = ubasic_tokenizer_num(&info->tokenizer_info);
+  if(info->gosub_stack_ptr < info->gosub_stack_depth) {
+    info->gosub_stack[info->gosub_stack_ptr] = tokenizer_position(info);
     info->gosub_stack_ptr++;
+    PROFILE_HOOK(info, call);
     jump_linenum(info, linenum);
   } else {
     DEBUG_PRINTF("gosub_statement: gosub stack exhausted\n");
+    raise_error(info, UBASIC_ERROR_GOSUB_STACK_OVERFLOW);
   }
 }
 /*---------------------------------------------------------------------------*/
@@ -499,7 +1184,8 @@ return_statement(ubasic_info *info)
   accept(info, TOKENIZER_RETURN);
   if(info->gosub_stack_ptr > 0) {
     info->gosub_stack_ptr--;
-    jump_linenum(info, info->gosub_stack[info->gosub_stack_ptr]);
+    PROFILE_HOOK(info, return);
+    tokenizer_jump(info, info->gosub_stack[info->gosub_stack_ptr]);
   } else {
     DEBUG_PRINTF("return_statement: non-matching return\n");
   }
@@ -511,14 +1197,17 @@ next_statement(ubasic_info *info)
   int var;
 
   accept(info, TOKENIZER_NEXT);
-  var = ubasic_tokenizer_variable_num(&info->tokenizer_info);
+  var = tokenizer_variable_num(info);
   accept(info, TOKENIZER_VARIABLE);
   if(info->for_stack_ptr > 0 &&
      var == info->for_stack[info->for_stack_ptr - 1].for_variable) {
-    ubasic_set_variable(info, var,
-                       ubasic_get_variable(info, var) + 1);
-    if(ubasic_get_variable(info, var) <= info->for_stack[info->for_stack_ptr - 1].to) {
-      jump_linenum(info, info->for_stack[info->for_stack_ptr - 1].line_after_for);
+    set_variable(info, var, arith_add(get_variable(info, var),
+                                      VARIABLE_FROM_INT(1), &info->error));
+    if(info->error != UBASIC_ERROR_NONE) {
+      raise_error(info, info->error);
+    }
+    if(get_variable(info, var) <= info->for_stack[info->for_stack_ptr - 1].to) {
+      tokenizer_jump(info, info->for_stack[info->for_stack_ptr - 1].pos_after_for);
     } else {
       info->for_stack_ptr--;
       accept(info, TOKENIZER_CR);
@@ -533,19 +1222,20 @@ next_statement(ubasic_info *info)
 static void
 for_statement(ubasic_info *info)
 {
-  int for_variable, to;
+  int for_variable;
+  VARIABLE_TYPE to;
 
   accept(info, TOKENIZER_FOR);
-  for_variable = ubasic_tokenizer_variable_num(&info->tokenizer_info);
+  for_variable = tokenizer_variable_num(info);
   accept(info, TOKENIZER_VARIABLE);
   accept(info, TOKENIZER_EQ);
-  ubasic_set_variable(info, for_variable, expr(info));
+  set_variable(info, for_variable, expr(info));
   accept(info, TOKENIZER_TO);
   to = expr(info);
   accept(info, TOKENIZER_CR);
 
-  if(info->for_stack_ptr < MAX_FOR_STACK_DEPTH) {
-    info->for_stack[info->for_stack_ptr].line_after_for = ubasic_tokenizer_num(&info->tokenizer_info);
+  if(info->for_stack_ptr < info->for_stack_depth) {
+    info->for_stack[info->for_stack_ptr].pos_after_for = tokenizer_position(info);
     info->for_stack[info->for_stack_ptr].for_variable = for_variable;
     info->for_stack[info->for_stack_ptr].to = to;
     DEBUG_PRINTF("for_statement: new for, var %d to %d\n",
@@ -555,6 +1245,7 @@ for_statement(ubasic_info *info)
     info->for_stack_ptr++;
   } else {
     DEBUG_PRINTF("for_statement: for stack depth exceeded\n");
+    raise_error(info, UBASIC_ERROR_FOR_STACK_OVERFLOW);
   }
 }
 /*---------------------------------------------------------------------------*/
@@ -567,12 +1258,12 @@ input_statement(ubasic_info *info)
   accept(info, TOKENIZER_INPUT);
   usr_value = expr(info);
   accept(info, TOKENIZER_COMMA);
-  var = ubasic_tokenizer_variable_num(&info->tokenizer_info);
+  var = tokenizer_variable_num(info);
   accept(info, TOKENIZER_VARIABLE);
   accept(info, TOKENIZER_CR);
 
   if(info->input_function != NULL) {
-    ubasic_set_variable(info, var, info->input_function(usr_value, info->app_context));
+    PROFILE_CALLBACK(info, set_input(info, var, info->input_function(usr_value, info->app_context)));
   }
 }
 /*---------------------------------------------------------------------------*/
@@ -581,65 +1272,131 @@ user_statement(ubasic_info *info)
 {
   accept(info, TOKENIZER_USER);
 
-  info->user_begin_function(info->app_context);
+  PROFILE_CALLBACK(info, info->user_begin_function(info->app_context));
 
   do {
     DEBUG_PRINTF("User loop\n");
-    if(ubasic_tokenizer_token(&info->tokenizer_info) == TOKENIZER_STRING) {
-      ubasic_tokenizer_string(&info->tokenizer_info, info->string, sizeof(info->string));
+    if(tokenizer_token(info) == TOKENIZER_STRING) {
+      tokenizer_string(info, info->string, sizeof(info->string));
 
       if(info->user_string_function != NULL) {
-        info->user_string_function(info->string, info->app_context);
+        PROFILE_CALLBACK(info, info->user_string_function(info->string, info->app_context));
       }
 
-      ubasic_tokenizer_next(&info->tokenizer_info);
-    } else if(ubasic_tokenizer_token(&info->tokenizer_info) == TOKENIZER_COMMA) {
+      tokenizer_next(info);
+    } else if(tokenizer_token(info) == TOKENIZER_COMMA) {
       if(info->user_separator_function != NULL) {
-        info->user_separator_function(',', info->app_context);
+        PROFILE_CALLBACK(info, info->user_separator_function(',', info->app_context));
       }
 
-      ubasic_tokenizer_next(&info->tokenizer_info);
-    } else if(ubasic_tokenizer_token(&info->tokenizer_info) == TOKENIZER_SEMICOLON) {
+      tokenizer_next(info);
+    } else if(tokenizer_token(info) == TOKENIZER_SEMICOLON) {
       if(info->user_separator_function != NULL) {
-        info->user_separator_function(';', info->app_context);
+        PROFILE_CALLBACK(info, info->user_separator_function(';', info->app_context));
       }
 
-      ubasic_tokenizer_next(&info->tokenizer_info);
-    } else if(ubasic_tokenizer_token(&info->tokenizer_info) == TOKENIZER_VARIABLE ||
-      ubasic_tokenizer_token(&info->tokenizer_info) == TOKENIZER_NUMBER) {
+      tokenizer_next(info);
+    } else if(tokenizer_token(info) == TOKENIZER_VARIABLE ||
+              tokenizer_token(info) == TOKENIZER_NUMBER ||
+              tokenizer_token(info) == TOKENIZER_EXPR) {
 
       if(info->user_separator_function != NULL) {
-        info->user_num_function(expr(info), info->app_context);
+        VARIABLE_TYPE num = expr(info);
+        PROFILE_CALLBACK(info, info->user_num_function(num, info->app_context));
       }
     } else {
       break;
     }
-  } while(ubasic_tokenizer_token(&info->tokenizer_info) != TOKENIZER_CR &&
-          ubasic_tokenizer_token(&info->tokenizer_info) != TOKENIZER_ENDOFINPUT);
+  } while(tokenizer_token(info) != TOKENIZER_CR &&
+          tokenizer_token(info) != TOKENIZER_ENDOFINPUT);
 
   if(info->user_end_function != NULL) {
-	  info->user_end_function(info->app_context);
+	  PROFILE_CALLBACK(info, info->user_end_function(info->app_context));
   }
 
   DEBUG_PRINTF("End of User\n");
-  ubasic_tokenizer_next(&info->tokenizer_info);
+  tokenizer_next(info);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Checks the count of a block PEEK or POKE and makes an int of it.
+ */
+static int
+block_count(ubasic_info *info, VARIABLE_TYPE count)
+{
+  if(count < 0) {
+    raise_error(info, UBASIC_ERROR_OUT_OF_RANGE);
+  }
+#if UBASIC_VARTYPE == UBASIC_VARTYPE_INT64
+  /* Only a 64-bit count can be too large for an int. */
+  if(count > (VARIABLE_TYPE)INT_MAX) {
+    raise_error(info, UBASIC_ERROR_OUT_OF_RANGE);
+  }
+#endif
+  return VARIABLE_TO_INT(count);
 }
 /*---------------------------------------------------------------------------*/
 static void
 peek_statement(ubasic_info *info)
 {
   VARIABLE_TYPE peek_addr;
-  int var;
+  int var, pos;
 
   accept(info, TOKENIZER_PEEK);
   peek_addr = expr(info);
   accept(info, TOKENIZER_COMMA);
-  var = ubasic_tokenizer_variable_num(&info->tokenizer_info);
+
+  /* Only a variable on its own ends the statement; anything else is the
+     count of a block PEEK, which may start with a variable too. */
+  pos = tokenizer_position(info);
+  if(tokenizer_token(info) == TOKENIZER_VARIABLE) {
+    var = tokenizer_variable_num(info);
+    tokenizer_next(info);
+    if(tokenizer_token(info) == TOKENIZER_CR) {
+      tokenizer_next(info);
+      if(info->peek_function != NULL) {
+        PROFILE_CALLBACK(info, set_input(info, var, info->peek_function(peek_addr, info->app_context)));
+      }
+      return;
+    }
+    tokenizer_jump(info, pos);
+  }
+  peek_block(info, peek_addr);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * PEEK addr, count, var reads count values from consecutive addresses
+ * into var and the variables after it, which have to be among a to z:
+ * the slots of longer names depend on where they first appear.
+ */
+static void
+peek_block(ubasic_info *info, VARIABLE_TYPE peek_addr)
+{
+  int count, var;
+  int i;
+
+  count = block_count(info, expr(info));
+  accept(info, TOKENIZER_COMMA);
+  var = tokenizer_variable_num(info);
   accept(info, TOKENIZER_VARIABLE);
+  if(var >= 26 || count > 26 - var) {
+    raise_error(info, UBASIC_ERROR_OUT_OF_RANGE);
+  }
   accept(info, TOKENIZER_CR);
 
-  if(info->peek_function != NULL) {
-    ubasic_set_variable(info, var, info->peek_function(peek_addr, info->app_context));
+  if(info->peek_block_function != NULL) {
+    if(count > 0) {
+      PROFILE_CALLBACK(info, info->peek_block_function(peek_addr, &info->variables[var], count, info->app_context));
+    }
+  } else if(info->peek_function != NULL) {
+    for(i = 0; i < count; i++) {
+      PROFILE_CALLBACK(info, set_variable(info, var + i, info->peek_function(peek_addr + VARIABLE_FROM_INT(i), info->app_context)));
+    }
+  }
+  if(info->suspended) {
+    /* A block cannot wait for its values, so they are taken as they are. */
+    info->suspended = 0;
+    info->ended = 0;
   }
 }
 /*---------------------------------------------------------------------------*/
@@ -653,10 +1410,67 @@ poke_statement(ubasic_info *info)
   poke_addr = expr(info);
   accept(info, TOKENIZER_COMMA);
   value = expr(info);
+  if(tokenizer_token(info) == TOKENIZER_COMMA) {
+    /* What looked like the value was the count of a block POKE. */
+    poke_block(info, poke_addr, block_count(info, value));
+    return;
+  }
   accept(info, TOKENIZER_CR);
 
   if(info->poke_function != NULL) {
-    info->poke_function(poke_addr, value, info->app_context);
+    PROFILE_CALLBACK(info, info->poke_function(poke_addr, value, info->app_context));
+  }
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * POKE addr, count, value writes value to count consecutive addresses, and
+ * POKE addr, count, #var writes var and the variables after it, among a
+ * to z as for PEEK.
+ */
+static void
+poke_block(ubasic_info *info, VARIABLE_TYPE poke_addr, int count)
+{
+  VARIABLE_TYPE fill[BLOCK_FILL_LEN];
+  VARIABLE_TYPE value;
+  const VARIABLE_TYPE *values;
+  int var, n, step;
+  int i;
+
+  accept(info, TOKENIZER_COMMA);
+  if(tokenizer_token(info) == TOKENIZER_HASH) {
+    accept(info, TOKENIZER_HASH);
+    var = tokenizer_variable_num(info);
+    accept(info, TOKENIZER_VARIABLE);
+    if(var >= 26 || count > 26 - var) {
+      raise_error(info, UBASIC_ERROR_OUT_OF_RANGE);
+    }
+    accept(info, TOKENIZER_CR);
+    values = &info->variables[var];
+    step = 1;
+  } else {
+    value = expr(info);
+    accept(info, TOKENIZER_CR);
+    /* A fill is written from a run of copies of the value, a piece at a
+       time, so values does not move on. */
+    for(i = 0; i < count && i < BLOCK_FILL_LEN; i++) {
+      fill[i] = value;
+    }
+    values = fill;
+    step = 0;
+  }
+
+  if(info->poke_block_function != NULL) {
+    for(i = 0; i < count; i += n) {
+      n = count - i;
+      if(step == 0 && n > BLOCK_FILL_LEN) {
+        n = BLOCK_FILL_LEN;
+      }
+      PROFILE_CALLBACK(info, info->poke_block_function(poke_addr + VARIABLE_FROM_INT(i), values + i * step, n, info->app_context));
+    }
+  } else if(info->poke_function != NULL) {
+    for(i = 0; i < count; i++) {
+      PROFILE_CALLBACK(info, info->poke_function(poke_addr + VARIABLE_FROM_INT(i), values[i * step], info->app_context));
+    }
   }
 }
 /*---------------------------------------------------------------------------*/
@@ -665,6 +1479,7 @@ end_statement(ubasic_info *info)
 {
   accept(info, TOKENIZER_END);
   info->ended = 1;
+  ubasic_output_flush(&info->output);
 }
 /*---------------------------------------------------------------------------*/
 static void
@@ -672,7 +1487,7 @@ statement(ubasic_info *info)
 {
   int token;
 
-  token = ubasic_tokenizer_token(&info->tokenizer_info);
+  token = tokenizer_token(info);
 
   switch(token) {
   case TOKENIZER_PRINT:
@@ -711,6 +1526,9 @@ statement(ubasic_info *info)
   case TOKENIZER_END:
     end_statement(info);
     break;
+  case TOKENIZER_DIM:
+    dim_statement(info);
+    break;
   case TOKENIZER_LET:
     accept(info, TOKENIZER_LET);
     /* Fall through. */
@@ -719,7 +1537,7 @@ statement(ubasic_info *info)
     break;
   default:
     DEBUG_PRINTF("ubasic.c: statement(): not implemented %d\n", token);
-    exit(1);
+    raise_error(info, UBASIC_ERROR_SYNTAX);
   }
 }
 /*---------------------------------------------------------------------------*/
@@ -727,41 +1545,407 @@ static void
 line_statement(ubasic_info *info)
 {
   DEBUG_PRINTF("----------- Line number %d ---------\n", ubasic_tokenizer_num());
-  index_add(info, ubasic_tokenizer_num(&info->tokenizer_info), ubasic_tokenizer_pos(&info->tokenizer_info));
+  PROFILE_LINE_BEGIN(info, tokenizer_num(info));
   accept(info, TOKENIZER_NUMBER);
   statement(info);
+  PROFILE_HOOK(info, line_end);
   return;
 }
 /*---------------------------------------------------------------------------*/
 void
 ubasic_run(ubasic_info *info)
 {
-  if(ubasic_tokenizer_finished(&info->tokenizer_info)) {
+  if(ubasic_finished(info) || info->suspended) {
     DEBUG_PRINTF("uBASIC program finished\n");
     return;
   }
 
+  if(setjmp(info->error_jump) != 0) {
+    return;
+  }
   line_statement(info);
+  if(info->suspended || tokenizer_finished(info)) {
+    ubasic_output_flush(&info->output);
+  }
 }
 /*---------------------------------------------------------------------------*/
+/*
+ * Runs up to max_steps lines in one go and returns the number of lines
+ * that were run, which is less than max_steps only when the program has
+ * finished, or -1 if it stopped with an error.
+ */
+int
+ubasic_run_until(ubasic_info *info, int max_steps)
+{
+  int steps;
+
+  /* The lines are run in a function of their own, so that the setjmp()
+     here does not hold back the optimization of the interpreter loop. */
+  if(setjmp(info->error_jump) != 0) {
+    return -1;
+  }
+  steps = run_until(info, max_steps);
+  if(steps < max_steps) {
+    ubasic_output_flush(&info->output);
+  }
+  return steps;
+}
+/*---------------------------------------------------------------------------*/
+static int
+run_until(ubasic_info *info, int max_steps)
+{
+  int steps;
+
+#if UBASIC_COMPUTED_GOTO
+  /* One entry per token, in the order of the token enum. Every statement
+     jumps straight to the next one through this table instead of
+     returning to a loop around statement(). */
+  static void * const dispatch[TOKENIZER_EXPR + 1] = {
+    &&do_error,     /* TOKENIZER_ERROR */
+    &&do_error,     /* TOKENIZER_ENDOFINPUT */
+    &&do_error,     /* TOKENIZER_NUMBER */
+    &&do_error,     /* TOKENIZER_STRING */
+    &&do_let,       /* TOKENIZER_VARIABLE */
+    &&do_let,       /* TOKENIZER_LET */
+    &&do_print,     /* TOKENIZER_PRINT */
+    &&do_if,        /* TOKENIZER_IF */
+    &&do_error,     /* TOKENIZER_THEN */
+    &&do_error,     /* TOKENIZER_ELSE */
+    &&do_for,       /* TOKENIZER_FOR */
+    &&do_error,     /* TOKENIZER_TO */
+    &&do_next,      /* TOKENIZER_NEXT */
+    &&do_goto,      /* TOKENIZER_GOTO */
+    &&do_gosub,     /* TOKENIZER_GOSUB */
+    &&do_return,    /* TOKENIZER_RETURN */
+    &&do_error,     /* TOKENIZER_CALL */
+    &&do_error,     /* TOKENIZER_REM */
+    &&do_input,     /* TOKENIZER_INPUT */
+    &&do_user,      /* TOKENIZER_USER */
+    &&do_peek,      /* TOKENIZER_PEEK */
+    &&do_poke,      /* TOKENIZER_POKE */
+    &&do_end,       /* TOKENIZER_END */
+    &&do_dim,       /* TOKENIZER_DIM */
+    &&do_error,     /* TOKENIZER_COMMA */
+    &&do_error,     /* TOKENIZER_SEMICOLON */
+    &&do_error,     /* TOKENIZER_PLUS */
+    &&do_error,     /* TOKENIZER_MINUS */
+    &&do_error,     /* TOKENIZER_AND */
+    &&do_error,     /* TOKENIZER_OR */
+    &&do_error,     /* TOKENIZER_ASTR */
+    &&do_error,     /* TOKENIZER_SLASH */
+    &&do_error,     /* TOKENIZER_MOD */
+    &&do_error,     /* TOKENIZER_HASH */
+    &&do_error,     /* TOKENIZER_LEFTPAREN */
+    &&do_error,     /* TOKENIZER_RIGHTPAREN */
+    &&do_error,     /* TOKENIZER_LT */
+    &&do_error,     /* TOKENIZER_GT */
+    &&do_error,     /* TOKENIZER_EQ */
+    &&do_error,     /* TOKENIZER_CR */
+    &&do_error,     /* TOKENIZER_EXPR */
+  };
+
+#define DISPATCH()                                              \
+  do {                                                          \
+    if(steps > 0) {                                             \
+      PROFILE_HOOK(info, line_end);                             \
+    }                                                           \
+    if(steps == max_steps || info->ended ||                     \
+       tokenizer_finished(info)) {                              \
+      return steps;                                             \
+    }                                                           \
+    steps++;                                                    \
+    PROFILE_LINE_BEGIN(info, tokenizer_num(info));              \
+    accept(info, TOKENIZER_NUMBER);                             \
+    goto *dispatch[tokenizer_token(info)];                      \
+  } while(0)
+
+  steps = 0;
+  DISPATCH();
+
+ do_print:
+  print_statement(info);
+  DISPATCH();
+ do_if:
+  if_statement(info);
+  DISPATCH();
+ do_goto:
+  goto_statement(info);
+  DISPATCH();
+ do_gosub:
+  gosub_statement(info);
+  DISPATCH();
+ do_return:
+  return_statement(info);
+  DISPATCH();
+ do_for:
+  for_statement(info);
+  DISPATCH();
+ do_input:
+  input_statement(info);
+  DISPATCH();
+ do_user:
+  user_statement(info);
+  DISPATCH();
+ do_peek:
+  peek_statement(info);
+  DISPATCH();
+ do_poke:
+  poke_statement(info);
+  DISPATCH();
+ do_next:
+  next_statement(info);
+  DISPATCH();
+ do_end:
+  end_statement(info);
+  DISPATCH();
+ do_dim:
+  dim_statement(info);
+  DISPATCH();
+ do_let:
+ do_error:
+  /* statement() takes care of LET as well as of reporting bad tokens. */
+  statement(info);
+  DISPATCH();
+
+#undef DISPATCH
+#else /* UBASIC_COMPUTED_GOTO */
+  for(steps = 0; steps < max_steps; steps++) {
+    if(info->ended || tokenizer_finished(info)) {
+      break;
+    }
+    line_statement(info);
+  }
+  return steps;
+#endif /* UBASIC_COMPUTED_GOTO */
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Runs the program once for each of n records. A record is
+ * UBASIC_BATCH_VARIABLES values, the starting values of the variables
+ * a to z, and the values of a to z when the program ends are written to
+ * the same record in outputs. Variables with longer names start at 0.
+ * Only the variables and the program position are reset between
+ * records; the program and callbacks are set up once.
+ */
+void
+ubasic_exec_batch(ubasic_info *info, const VARIABLE_TYPE *inputs, size_t n,
+                  VARIABLE_TYPE *outputs)
+{
+  size_t i;
+
+  for(i = 0; i < n; i++) {
+    reset(info);
+    memset(info->variables, 0, sizeof(info->variables));
+    memcpy(info->variables, inputs + i * UBASIC_BATCH_VARIABLES,
+           UBASIC_BATCH_VARIABLES * sizeof(VARIABLE_TYPE));
+    while(ubasic_run_until(info, INT_MAX) == INT_MAX);
+    memcpy(outputs + i * UBASIC_BATCH_VARIABLES, info->variables,
+           UBASIC_BATCH_VARIABLES * sizeof(VARIABLE_TYPE));
+  }
+}
+/*---------------------------------------------------------------------------*/
+#if UBASIC_PROFILE
+/*
+ * Starts collecting per-line statistics for the interpreter; they are
+ * available in info->profile until ubasic_free() is called.
+ */
+int
+ubasic_profile_start(ubasic_info *info)
+{
+  ubasic_profile_free(info->profile);
+  if(info->program != NULL) {
+    info->profile = ubasic_profile_new(info->program->lines,
+                                       info->program->num_lines);
+  } else {
+    info->profile = ubasic_profile_new(info->text_index.lines,
+                                       info->text_index.num_lines);
+  }
+  return info->profile != NULL ? 0 : -1;
+}
+#endif /* UBASIC_PROFILE */
+/*---------------------------------------------------------------------------*/
 int
 ubasic_finished(ubasic_info *info)
 {
-  return info->ended || ubasic_tokenizer_finished(&info->tokenizer_info);
+  return !info->suspended && (info->ended || tokenizer_finished(info));
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Called by an input_function or peek_function that cannot give its value
+ * straight away. The value it returns is ignored, and the program stops
+ * after the current line, in ubasic_run() and ubasic_run_until() alike,
+ * until the host has the value and passes it to ubasic_resume(). Only
+ * INPUT and the single variable form of PEEK can be suspended.
+ */
+void
+ubasic_suspend(ubasic_info *info)
+{
+  info->suspended = 1;
+  info->ended = 1;
+}
+/*---------------------------------------------------------------------------*/
+int
+ubasic_suspended(ubasic_info *info)
+{
+  return info->suspended;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Finishes the INPUT or PEEK that the program was suspended in, with the
+ * value it was waiting for. The program carries on with the next call to
+ * ubasic_run() or ubasic_run_until().
+ */
+void
+ubasic_resume(ubasic_info *info, VARIABLE_TYPE value)
+{
+  if(!info->suspended) {
+    return;
+  }
+  info->suspended = 0;
+  info->ended = 0;
+  set_variable(info, info->suspended_var, value);
+}
+/*---------------------------------------------------------------------------*/
+int
+ubasic_error(ubasic_info *info)
+{
+  return info->error;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Replaces the GOSUB and FOR stacks with ones of the given depths,
+ * allocated with the interpreter's allocator, and empties them. Returns
+ * -1, keeping the old stacks, if there is not enough memory.
+ */
+int
+ubasic_set_stack_depths(ubasic_info *info, int gosub_depth, int for_depth)
+{
+  struct ubasic_for_state *for_stack;
+  size_t size;
+
+  if(gosub_depth < 0 || for_depth < 0) {
+    return -1;
+  }
+  size = for_depth * sizeof(struct ubasic_for_state) +
+    gosub_depth * sizeof(int);
+  for_stack = info->allocator.alloc(size, info->allocator.context);
+  if(for_stack == NULL && size > 0) {
+    DEBUG_PRINTF("ubasic_set_stack_depths: out of memory\n");
+    return -1;
+  }
+
+  if(info->for_stack != NULL) {
+    info->allocator.free(info->for_stack, info->allocator.context);
+  }
+  info->for_stack = for_stack;
+  info->for_stack_depth = for_depth;
+  info->for_stack_ptr = 0;
+  info->gosub_stack = (int *)(for_stack + for_depth);
+  info->gosub_stack_depth = gosub_depth;
+  info->gosub_stack_ptr = 0;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Replaces the output buffer with one of the given size, allocated with
+ * the interpreter's allocator, after writing out what is in it. A size of
+ * 0 writes every item straight away. Returns -1, keeping the old buffer,
+ * if there is not enough memory.
+ */
+int
+ubasic_set_output_size(ubasic_info *info, size_t size)
+{
+  char *buffer;
+
+  buffer = NULL;
+  if(size > 0) {
+    buffer = info->allocator.alloc(size, info->allocator.context);
+    if(buffer == NULL) {
+      DEBUG_PRINTF("ubasic_set_output_size: out of memory\n");
+      return -1;
+    }
+  }
+
+  ubasic_output_flush(&info->output);
+  if(info->output.buffer != NULL) {
+    info->allocator.free(info->output.buffer, info->allocator.context);
+  }
+  info->output.buffer = buffer;
+  info->output.size = size;
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Replaces the array pool with one that has room for cells elements on
+ * top of the arrays that a compiled program is given up front, allocated
+ * with the interpreter's allocator, and empties all arrays. Returns -1,
+ * keeping the old pool, if there is not enough memory.
+ */
+int
+ubasic_set_array_size(ubasic_info *info, int cells)
+{
+  VARIABLE_TYPE *pool;
+  size_t size;
+
+  if(cells < 0) {
+    return -1;
+  }
+  if(info->program != NULL) {
+    if(cells > INT_MAX / (int)sizeof(VARIABLE_TYPE) -
+       info->program->array_cells) {
+      return -1;
+    }
+    cells += info->program->array_cells;
+  }
+  size = cells * sizeof(VARIABLE_TYPE);
+  pool = info->allocator.alloc(size, info->allocator.context);
+  if(pool == NULL && size > 0) {
+    DEBUG_PRINTF("ubasic_set_array_size: out of memory\n");
+    return -1;
+  }
+
+  if(info->array_pool != NULL) {
+    info->allocator.free(info->array_pool, info->allocator.context);
+  }
+  info->array_pool = pool;
+  info->array_pool_size = cells;
+  arrays_reset(info);
+  return 0;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Writes out whatever the default print functions have collected so far.
+ */
+void
+ubasic_flush(ubasic_info *info)
+{
+  ubasic_output_flush(&info->output);
 }
 /*---------------------------------------------------------------------------*/
 void
 ubasic_set_variable(ubasic_info *info, int varnum, VARIABLE_TYPE value)
 {
-  if(varnum >= 0 && varnum <= MAX_VARNUM) {
+  if(varnum >= 0 && varnum < MAX_VARNUM) {
     info->variables[varnum] = value;
   }
 }
 /*---------------------------------------------------------------------------*/
+/*
+ * Returns the slot of the variable called name in the interpreter's
+ * program, for ubasic_get_variable() and ubasic_set_variable(), or -1 if
+ * the program has no such variable. Slots do not change while the
+ * program is set up, so hosts can look them up once.
+ */
+int
+ubasic_variable_slot(ubasic_info *info, const char *name)
+{
+  return ubasic_symbols_find(info->symbols, name, strlen(name));
+}
+/*---------------------------------------------------------------------------*/
 VARIABLE_TYPE
 ubasic_get_variable(ubasic_info *info, int varnum)
 {
-  if(varnum >= 0 && varnum <= MAX_VARNUM) {
+  if(varnum >= 0 && varnum < MAX_VARNUM) {
     return info->variables[varnum];
   }
   return 0;
@@ -776,24 +1960,24 @@ print_begin(void *context)
 static void
 print_num(VARIABLE_TYPE num, void *context)
 {
-  printf("%d", num);
+  ubasic_output_num(context, num);
 }
 /*---------------------------------------------------------------------------*/
 static void
 print_string(const char *str, void *context)
 {
-  printf("%s", str);
+  ubasic_output_write(context, str, strlen(str));
 }
 /*---------------------------------------------------------------------------*/
 static void
 print_separator(const char sep, void *context)
 {
-  printf("%s", " ");
+  ubasic_output_char(context, ' ');
 }
 /*---------------------------------------------------------------------------*/
 static void
 print_end(void *context)
 {
-  printf("\n");
+  ubasic_output_char(context, '\n');
 }
 /*---------------------------------------------------------------------------*/
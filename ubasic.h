@@ -34,36 +34,90 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+#include <setjmp.h>
+
 #include "vartype.h"
 #include "tokenizer.h"
+#include "compiler.h"
+#include "output.h"
+
+/* Build with -DUBASIC_PROFILE=1 for per-line profiling, see profile.h. */
+#ifndef UBASIC_PROFILE
+#define UBASIC_PROFILE 0
+#endif
+
+#if UBASIC_PROFILE
+#include "profile.h"
+#endif
 
 #define MAX_STRINGLEN 40
+#define MAX_VARNUM UBASIC_MAX_VARIABLES
+
+/* The values in a record of ubasic_exec_batch(), those of a to z. */
+#define UBASIC_BATCH_VARIABLES 26
+
+/* The stack depths every interpreter starts out with, see
+   ubasic_set_stack_depths(). */
 #define MAX_GOSUB_STACK_DEPTH 10
 #define MAX_FOR_STACK_DEPTH 4
-#define MAX_VARNUM 26
 
+/* The size of the output buffer every interpreter starts out with, see
+   ubasic_set_output_size(). */
+#define UBASIC_OUTPUT_SIZE 512
+
+/* The number of array elements that DIM can hand out while a program
+   runs, see ubasic_set_array_size(). */
+#define UBASIC_ARRAY_SIZE 256
+
+/* Why a program stopped before its END, see ubasic_error(). */
+enum {
+  UBASIC_ERROR_NONE,
+  UBASIC_ERROR_OVERFLOW,
+  UBASIC_ERROR_DIVISION_BY_ZERO,
+  UBASIC_ERROR_GOSUB_STACK_OVERFLOW,
+  UBASIC_ERROR_FOR_STACK_OVERFLOW,
+  UBASIC_ERROR_SYNTAX,
+  UBASIC_ERROR_OUT_OF_RANGE,
+  UBASIC_ERROR_OUT_OF_MEMORY,
+};
 
 typedef VARIABLE_TYPE (*peek_func)(VARIABLE_TYPE, void *);
 typedef VARIABLE_TYPE (*usr_func)(VARIABLE_TYPE, void *);
 typedef VARIABLE_TYPE (*input_func)(VARIABLE_TYPE, void *);
 typedef void (*poke_func)(VARIABLE_TYPE, VARIABLE_TYPE, void *);
 
+/* Move count values at once, between consecutive addresses starting at
+   the first argument and the array in the second. */
+typedef void (*peek_block_func)(VARIABLE_TYPE, VARIABLE_TYPE *, int, void *);
+typedef void (*poke_block_func)(VARIABLE_TYPE, const VARIABLE_TYPE *, int,
+                                void *);
+
 typedef void (*begin_func)(void *);
 typedef void (*handle_num_func)(VARIABLE_TYPE, void *);
 typedef void (*handle_string_func)(const char *, void *);
 typedef void (*handle_separator_func)(const char, void *);
 typedef void (*end_func)(void *);
 
+/*
+ * Program positions are offsets of a token, into the program text or, for
+ * compiled programs, into the code array.
+ */
 struct ubasic_for_state {
-  int line_after_for;
+  int pos_after_for;
   int for_variable;
-  int to;
+  VARIABLE_TYPE to;
 };
 
-struct ubasic_line_index {
-  int line_number;
-  char const *program_text_position;
-  struct ubasic_line_index *next;
+/*
+ * An array is size1 elements, or size1 rows of size2 elements, taken from
+ * the interpreter's array pool, which has room for capacity of them.
+ */
+struct ubasic_array {
+  VARIABLE_TYPE *values;
+  int size1;
+  int size2;
+  int capacity;
 };
 
 
@@ -73,23 +127,54 @@ typedef struct {
   char const *program_ptr;
   char string[MAX_STRINGLEN];
 
-  int gosub_stack[MAX_GOSUB_STACK_DEPTH];
+  /* Return positions, see pos_after_for. Both stacks are allocated with
+     the interpreter's allocator. */
+  int *gosub_stack;
   int gosub_stack_ptr;
+  int gosub_stack_depth;
 
-  struct ubasic_for_state for_stack[MAX_FOR_STACK_DEPTH];
+  struct ubasic_for_state *for_stack;
   int for_stack_ptr;
+  int for_stack_depth;
 
-  struct ubasic_line_index *line_index_head;
-  struct ubasic_line_index *line_index_current;
+  /* Built when program text is set up, see ubasic_compiler_index(). */
+  struct ubasic_text_index text_index;
 
+  /* Indexed by slot, see tokenizer.h. The names of the slots after z
+     come from the compiled program or, for program text, from a table
+     built with the interpreter's allocator when it is set up. */
   VARIABLE_TYPE variables[MAX_VARNUM];
+  const struct ubasic_symbols *symbols;
+  int symbols_owned;
+
+  /* All arrays live in one pool, allocated with the interpreter's
+     allocator and emptied whenever the program starts again. */
+  struct ubasic_array arrays[UBASIC_MAX_ARRAYS];
+  VARIABLE_TYPE *array_pool;
+  int array_pool_size;
+  int array_pool_used;
 
+  /* Set at END, on an error and while suspended, see ubasic_suspend(). */
   int ended;
+  int suspended;
+  int suspended_var;
+
+  /* Where the program stopped with an error. The column counts from 1, or
+     is 0 for a compiled program without its text. */
+  int error;
+  int error_line_number;
+  int error_column;
+  jmp_buf error_jump;
 
   peek_func peek_function;
   poke_func poke_function;
   input_func input_function;
 
+  /* Used by the block forms of PEEK and POKE where set, which otherwise
+     call the functions above once per value. */
+  peek_block_func peek_block_function;
+  poke_block_func poke_block_function;
+
   begin_func print_begin_function;
   handle_num_func print_num_function;
   handle_string_func print_string_function;
@@ -102,14 +187,56 @@ typedef struct {
   handle_separator_func user_separator_function;
   end_func user_end_function;
 
+  /* Where the default print functions write to, see output.h. */
+  struct ubasic_output output;
+
   ubasic_tokenizer_info tokenizer_info;
+
+  /* Used for everything the interpreter allocates, see arena.h. */
+  struct ubasic_allocator allocator;
+
+  const struct ubasic_program *program;
+  int program_owned;
+  int pc;
+
+#if UBASIC_PROFILE
+  struct ubasic_profile *profile;
+#endif
 } ubasic_info;
 
 
 void ubasic_init(ubasic_info *info, const char *program);
+void ubasic_init_with(ubasic_info *info, const char *program,
+                      const struct ubasic_allocator *allocator);
+int ubasic_compile(ubasic_info *info, const char *program);
+int ubasic_compile_with(ubasic_info *info, const char *program,
+                        const struct ubasic_allocator *allocator);
+void ubasic_init_program(ubasic_info *info,
+                         const struct ubasic_program *program);
+void ubasic_init_program_with(ubasic_info *info,
+                              const struct ubasic_program *program,
+                              const struct ubasic_allocator *allocator);
+void ubasic_free(ubasic_info *info);
 void ubasic_run(ubasic_info *info);
+int ubasic_run_until(ubasic_info *info, int max_steps);
 int ubasic_finished(ubasic_info *info);
+int ubasic_error(ubasic_info *info);
+void ubasic_suspend(ubasic_info *info);
+int ubasic_suspended(ubasic_info *info);
+void ubasic_resume(ubasic_info *info, VARIABLE_TYPE value);
+int ubasic_set_stack_depths(ubasic_info *info, int gosub_depth,
+                            int for_depth);
+int ubasic_set_output_size(ubasic_info *info, size_t size);
+int ubasic_set_array_size(ubasic_info *info, int cells);
+void ubasic_flush(ubasic_info *info);
+void ubasic_exec_batch(ubasic_info *info, const VARIABLE_TYPE *inputs,
+                       size_t n, VARIABLE_TYPE *outputs);
+
+#if UBASIC_PROFILE
+int ubasic_profile_start(ubasic_info *info);
+#endif
 
+int ubasic_variable_slot(ubasic_info *info, const char *name);
 VARIABLE_TYPE ubasic_get_variable(ubasic_info *info, int varnum);
 void ubasic_set_variable(ubasic_info *info, int varum, VARIABLE_TYPE value);
 
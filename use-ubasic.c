@@ -44,11 +44,15 @@ static const char program[] =
 int
 main(void)
 {
-  ubasic_init(program);
+  ubasic_info info;
+
+  ubasic_init(&info, program);
 
   do {
-    ubasic_run();
-  } while(!ubasic_finished());
+    ubasic_run(&info);
+  } while(!ubasic_finished(&info));
+
+  ubasic_free(&info);
 
   return 0;
 }
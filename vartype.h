@@ -32,7 +32,47 @@
 #define __VARTYPE_H__
 
 #include <stdint.h>
+#include <inttypes.h>
 
+/*
+ * The type of BASIC variables and expressions is picked at build time with
+ * -DUBASIC_VARTYPE=UBASIC_VARTYPE_xxx. UBASIC_VARTYPE_FIXED is Q16.16 fixed
+ * point in an int32_t: variables, PEEK/POKE values and the values handed
+ * to the host all hold the raw fixed point number, which
+ * VARIABLE_FROM_INT() makes from an integer.
+ */
+#define UBASIC_VARTYPE_INT16 0
+#define UBASIC_VARTYPE_INT32 1
+#define UBASIC_VARTYPE_INT64 2
+#define UBASIC_VARTYPE_FIXED 3
+
+#ifndef UBASIC_VARTYPE
+#define UBASIC_VARTYPE UBASIC_VARTYPE_INT16
+#endif
+
+#if UBASIC_VARTYPE == UBASIC_VARTYPE_INT16
 #define VARIABLE_TYPE int16_t
+#define VARIABLE_TYPE_PRI PRId16
+#elif UBASIC_VARTYPE == UBASIC_VARTYPE_INT32
+#define VARIABLE_TYPE int32_t
+#define VARIABLE_TYPE_PRI PRId32
+#elif UBASIC_VARTYPE == UBASIC_VARTYPE_INT64
+#define VARIABLE_TYPE int64_t
+#define VARIABLE_TYPE_PRI PRId64
+#elif UBASIC_VARTYPE == UBASIC_VARTYPE_FIXED
+#define VARIABLE_TYPE int32_t
+#define VARIABLE_FIXED_SHIFT 16
+#else
+#error "Unknown UBASIC_VARTYPE"
+#endif
+
+#ifdef VARIABLE_FIXED_SHIFT
+#define VARIABLE_FROM_INT(n) \
+  ((VARIABLE_TYPE)((uint32_t)(n) << VARIABLE_FIXED_SHIFT))
+#define VARIABLE_TO_INT(v) ((v) >> VARIABLE_FIXED_SHIFT)
+#else
+#define VARIABLE_FROM_INT(n) ((VARIABLE_TYPE)(n))
+#define VARIABLE_TO_INT(v) (v)
+#endif
 
 #endif /* __VARTYPE_H__ */